@@ -427,9 +427,10 @@ hfcpci_empty_bfifo(struct bchannel *bch, struct bzfifo *bz,
 		bz->za[new_f2].z2 = cpu_to_le16(new_z2);
 		bz->f2 = new_f2;	/* next buffer */
 	} else {
-		bch->rx_skb = mI_alloc_skb(count - 3, GFP_ATOMIC);
-		if (!bch->rx_skb) {
-			printk(KERN_WARNING "HFCPCI: receive out of memory\n");
+		maxlen = bchannel_get_rxbuf(bch, count - 3);
+		if (maxlen < 0) {
+			pr_warning("B%d: No bufferspace for %d bytes\n",
+				   bch->nr, count - 3);
 			return;
 		}
 		count -= 3;
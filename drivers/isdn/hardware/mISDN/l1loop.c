@@ -41,6 +41,12 @@
  * - debug=<n>, default=0, with n=0xHHHHGGGG
  *      H - l1 driver flags described in hfcs_usb.h
  *      G - common mISDN debug flags described at mISDNhw.h
+ * - bench=<n>, default 0
+ *      if set, inject a benchmark frame into each active B-channel
+ *      every n us, instead of using the virtual line for B-channel
+ *      data. see l1loop_bench.c
+ * - benchlen=<n>, default 128
+ *      length of the benchmark frames
  *
  */
 
@@ -48,6 +54,7 @@
 #include <linux/delay.h>
 #include <linux/mISDNhw.h>
 #include "l1loop.h"
+#include "l1loop_bench.h"
 
 const char *l1loop_rev = "v0.2, 2011-09-30";
 
@@ -64,6 +71,8 @@ static unsigned int vline = 1;
 static unsigned int nchannel[32] = {2};
 static unsigned int pri;
 static unsigned int debug;
+static unsigned int bench;
+static unsigned int benchlen = 128;
 
 MODULE_AUTHOR("Martin Bachem");
 MODULE_LICENSE("GPL");
@@ -72,6 +81,8 @@ module_param(vline, uint, S_IRUGO | S_IWUSR);
 module_param_array(nchannel, uint, NULL, S_IRUGO | S_IWUSR);
 module_param(pri, uint, S_IRUGO | S_IWUSR);
 module_param(debug, uint, S_IRUGO | S_IWUSR);
+module_param(bench, uint, S_IRUGO);
+module_param(benchlen, uint, S_IRUGO);
 
 /*
  * send full D/B channel status information
@@ -171,55 +182,70 @@ deactivate_bchannel(struct bchannel *bch)
 	clear_bit(FLG_TX_BUSY, &bch->Flags);
 	spin_unlock(&p->lock);
 
+	l1loop_bench_stop(bch, p->instance);
+
 	l1loop_setup_bch(bch, ISDN_P_NONE);
 }
 
 /*
- * bch layer1 loop (vline=2): immediatly loop back every B-channel data
+ * queue a frame to bch's RX queue. the frame is owned by the target
+ * afterwards, it may be a clone sharing its data with other parties,
+ * so receivers must not write into it without unsharing it first
  */
-static void bch_vline_loop(struct bchannel *bch, struct sk_buff *skb)
+static void bch_vrecv(struct bchannel *bch, struct sk_buff *skb)
 {
 	struct port *p = bch->hw;
 
-	bch->rx_skb = skb_copy(skb, GFP_KERNEL);
-	if (bch->rx_skb)
-		recv_Bchannel(bch, MISDN_ID_ANY, false);
-	else
+	if (!skb) {
 		if (debug & DEBUG_HW)
-			printk(KERN_ERR "%s: %s: mI_alloc_skb failed\n",
+			printk(KERN_ERR "%s: %s: skb_clone failed\n",
 				p->name, __func__);
-	dev_kfree_skb(skb);
+		return;
+	}
+	bch->rx_skb = skb;
+	recv_Bchannel(bch, MISDN_ID_ANY, true);
+}
+
+/*
+ * bch layer1 loop (vline=2): immediatly loop back every B-channel data
+ */
+static void bch_vline_loop(struct bchannel *bch, struct sk_buff *skb)
+{
 	get_next_bframe(bch);
+	bch_vrecv(bch, skb);
 }
 
 /*
- * bch layer1 bus (vline=1): copy frame to each party with bch(x) FLAG_ACTIVE
+ * bch layer1 bus (vline=1): pass frame to each party with bch(x) FLAG_ACTIVE
+ * all but the last party get a clone, the last one gets the frame itself
  */
 static void bch_vbus(struct bchannel *bch, struct sk_buff *skb)
 {
 	struct port *me = bch->hw;
 	struct port *party;
-	struct bchannel *target = NULL;
+	struct bchannel *target, *last = NULL;
 	int i, b;
 
+	get_next_bframe(bch);
 	b = bch->nr - 1 - (bch->nr > 16);
 	for (i = 0; i < interfaces; i++) {
 		party = hw->ports + i;
 		target = &party->bch[b];
 		if ((me != party) && test_bit(FLG_ACTIVE, &target->Flags)) {
-			/* immediately queue data to bch's RX queue */
-			target->rx_skb = skb_copy(skb, GFP_KERNEL);
-			if (target->rx_skb)
-				recv_Bchannel(target, MISDN_ID_ANY, false);
+			if (last)
+				bch_vrecv(last, skb_clone(skb, GFP_KERNEL));
+			last = target;
 		}
 	}
 
-	dev_kfree_skb(skb);
-	get_next_bframe(bch);
+	if (last)
+		bch_vrecv(last, skb);
+	else
+		dev_kfree_skb(skb);
 }
 
 /*
- * bch layer1 link (vline=3): copy frame to ohter party, if bch(x) FLAG_ACTIVE
+ * bch layer1 link (vline=3): pass frame to ohter party, if bch(x) FLAG_ACTIVE
  */
 static void bch_vlink(struct bchannel *bch, struct sk_buff *skb)
 {
@@ -228,17 +254,13 @@ static void bch_vlink(struct bchannel *bch, struct sk_buff *skb)
 	struct bchannel *target = NULL;
 	int b;
 
+	get_next_bframe(bch);
 	b = bch->nr - 1 - (bch->nr > 16);
 	target = &party->bch[b];
-	if (test_bit(FLG_ACTIVE, &target->Flags)) {
-		/* immediately queue data to bch's RX queue */
-		target->rx_skb = skb_copy(skb, GFP_KERNEL);
-		if (target->rx_skb)
-			recv_Bchannel(target, MISDN_ID_ANY, false);
-	}
-
-	dev_kfree_skb(skb);
-	get_next_bframe(bch);
+	if (test_bit(FLG_ACTIVE, &target->Flags))
+		bch_vrecv(target, skb);
+	else
+		dev_kfree_skb(skb);
 }
 
 /*
@@ -258,6 +280,11 @@ l1loop_l2l1B(struct mISDNchannel *ch, struct sk_buff *skb) {
 		spin_unlock(&p->lock);
 		if (ret > 0) {
 			ret = 0;
+			if (bench) {
+				get_next_bframe(bch);
+				l1loop_bench_tx(skb);
+				return ret;
+			}
 			switch (vline) {
 			case VLINE_BUS:
 				bch_vbus(bch, skb);
@@ -279,9 +306,11 @@ l1loop_l2l1B(struct mISDNchannel *ch, struct sk_buff *skb) {
 			ret = l1loop_setup_bch(bch, ch->protocol);
 		else
 			ret = 0;
-		if (!ret)
+		if (!ret) {
 			_queue_data(ch, PH_ACTIVATE_IND, MISDN_ID_ANY,
 				0, NULL, GFP_KERNEL);
+			l1loop_bench_start(bch, p->instance, &p->lock);
+		}
 		break;
 	case PH_DEACTIVATE_REQ:
 		deactivate_bchannel(bch);
@@ -1057,7 +1086,19 @@ l1loop_init(void)
 		return -ENOMEM;
 	}
 
-	return setup_instance(hw);
+	if (bench) {
+		i = l1loop_bench_init(bench, benchlen, interfaces);
+		if (i) {
+			kfree(hw->ports);
+			kfree(hw);
+			return i;
+		}
+	}
+
+	i = setup_instance(hw);
+	if (i)
+		l1loop_bench_cleanup();
+	return i;
 }
 
 static void __exit
@@ -1067,6 +1108,7 @@ l1loop_cleanup(void)
 		printk(KERN_DEBUG DRIVER_NAME ": %s\n", __func__);
 
 	release_instance(hw);
+	l1loop_bench_cleanup();
 }
 
 module_init(l1loop_init);
@@ -0,0 +1,493 @@
+/* l1loop_bench.c
+ * benchmark mode of the virtual mISDN layer1 driver
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2, or (at your option)
+ * any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ *
+ * If the benchmark is enabled (bench=<us>), every active B-channel
+ * receives a frame of benchlen bytes each interval, instead of the data
+ * of the virtual line. The frame is passed up through hwchannel and,
+ * depending on how the channel is opened, through dsp and/or the socket
+ * layer, as transparent or HDLC data. The upper layer must send it back
+ * (e.g. an application echoing all data, or the dsp echo), data sent on
+ * a B-channel is not looped to the virtual line in benchmark mode.
+ *
+ * Each frame starts with a header holding the channel, a sequence
+ * number and the time of injection. Returned data is scanned for that
+ * header, so the frames may be rechunked on their way (transparent data
+ * through the dsp), but must not be altered (no volume, crypt, etc.).
+ *
+ * Latency is measured for these hops:
+ *  up   - injection until the upper layer consumed the frame
+ *         (dsp processed it or the socket queued it)
+ *         frames that do not fit into the receive queue of the B-channel
+ *         are dropped before injection and counted as dropped (and lost)
+ *  down - until the upper layer sent it back
+ *  rtt  - whole round trip
+ *
+ * /sys/kernel/debug/l1loop/bench shows the results, writing to it
+ * resets the statistic.
+ */
+
+#include <linux/module.h>
+#include <linux/slab.h>
+#include <linux/vmalloc.h>
+#include <linux/hrtimer.h>
+#include <linux/workqueue.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
+#include <asm/unaligned.h>
+#include "l1loop_bench.h"
+
+#define L1LOOP_BENCH_MAGIC	0x4d42314c	/* "L1BM" */
+#define L1LOOP_BENCH_SLOTS	24	/* log2 latency slots in us */
+#define L1LOOP_BENCH_UPRING	16	/* up timestamps kept per channel */
+
+struct l1loop_bench_hdr {
+	u32	magic;
+	u16	id;
+	u16	seq;
+	u64	ts;
+} __packed;
+
+/*
+ * skb->cb of injected frames, behind the mISDN header.
+ * upper layers may overwrite it, so id and seq are only used to find the
+ * frame in the channel table, see bench_find()
+ */
+struct l1loop_bench_cb {
+	struct mISDNhead	hh;
+	struct bchannel		*bch;
+	spinlock_t		*lock;
+	u16			id;
+	u16			seq;
+};
+
+struct l1loop_bench_hop {
+	u64	cnt;
+	u64	max;
+	u64	hist[L1LOOP_BENCH_SLOTS];
+};
+
+struct l1loop_bench_frame {
+	struct sk_buff	*skb;	/* injected, not yet consumed */
+	u16		seq;
+	u64		ts_in;	/* time of injection */
+	u64		ts;	/* time the upper layer consumed it */
+};
+
+struct l1loop_bench_chan {
+	struct bchannel	*bch;
+	spinlock_t	*lock;	/* port lock of bch */
+	u16		seq;	/* next injected frame */
+	u16		rseq;	/* next expected returned frame */
+	struct l1loop_bench_frame up[L1LOOP_BENCH_UPRING];
+};
+
+static DEFINE_SPINLOCK(bench_lock);
+static struct l1loop_bench_chan **bench_chans;
+static int bench_nrchans;
+static u_int bench_interval;
+static u_int bench_len;
+static struct hrtimer bench_timer;
+static struct work_struct bench_work;
+static struct dentry *bench_dir;
+
+static struct {
+	ktime_t			start;
+	u64			injected;
+	u64			returned;
+	u64			lost;
+	u64			late;
+	u64			dropped;
+	u64			nomem;
+	struct l1loop_bench_hop	up;
+	struct l1loop_bench_hop	down;
+	struct l1loop_bench_hop	rtt;
+} bench_stats;
+
+static inline struct l1loop_bench_cb *
+bench_cb(struct sk_buff *skb)
+{
+	return (struct l1loop_bench_cb *)skb->cb;
+}
+
+static void
+bench_count(struct l1loop_bench_hop *hop, u64 ns)
+{
+	int slot = fls64(ns >> 10);
+
+	if (slot >= L1LOOP_BENCH_SLOTS)
+		slot = L1LOOP_BENCH_SLOTS - 1;
+	hop->cnt++;
+	hop->hist[slot]++;
+	if (ns > hop->max)
+		hop->max = ns;
+}
+
+/*
+ * find the table entry of an injected frame, NULL if the frame is unknown
+ * or the cb was overwritten, must be called with bench_lock held
+ */
+static struct l1loop_bench_frame *
+bench_find(struct sk_buff *skb)
+{
+	struct l1loop_bench_cb *cb = bench_cb(skb);
+	struct l1loop_bench_chan *ch;
+	struct l1loop_bench_frame *f;
+
+	if (!bench_chans || cb->id >= bench_nrchans)
+		return NULL;
+	ch = bench_chans[cb->id];
+	if (!ch)
+		return NULL;
+	f = &ch->up[cb->seq % L1LOOP_BENCH_UPRING];
+	return f->skb == skb ? f : NULL;
+}
+
+/* called when the upper layer frees (or takes ownership of) the frame */
+static void
+bench_destruct(struct sk_buff *skb)
+{
+	struct l1loop_bench_frame *f;
+	u64 now = ktime_get_ns();
+	u_long flags;
+
+	spin_lock_irqsave(&bench_lock, flags);
+	f = bench_find(skb);
+	if (f) {
+		f->skb = NULL;
+		f->ts = now;
+		bench_count(&bench_stats.up, now - f->ts_in);
+	}
+	spin_unlock_irqrestore(&bench_lock, flags);
+}
+
+/* the frame did not fit into the receive queue */
+static void
+bench_drop(struct sk_buff *skb)
+{
+	struct l1loop_bench_frame *f;
+	u_long flags;
+
+	spin_lock_irqsave(&bench_lock, flags);
+	f = bench_find(skb);
+	if (f)
+		f->skb = NULL;
+	bench_stats.dropped++;
+	spin_unlock_irqrestore(&bench_lock, flags);
+	dev_kfree_skb(skb);
+}
+
+static void
+bench_inject(struct work_struct *work)
+{
+	struct l1loop_bench_chan *ch;
+	struct l1loop_bench_frame *f;
+	struct l1loop_bench_hdr hdr;
+	struct sk_buff_head frames;
+	struct bchannel *bch;
+	struct sk_buff *skb;
+	spinlock_t *lock;
+	u_long flags;
+	int i;
+
+	__skb_queue_head_init(&frames);
+	hdr.magic = L1LOOP_BENCH_MAGIC;
+	spin_lock_irqsave(&bench_lock, flags);
+	for (i = 0; i < bench_nrchans; i++) {
+		ch = bench_chans[i];
+		if (!ch)
+			continue;
+		skb = mI_alloc_skb(bench_len, GFP_ATOMIC);
+		if (!skb) {
+			bench_stats.nomem++;
+			continue;
+		}
+		hdr.id = i;
+		hdr.seq = ch->seq++;
+		hdr.ts = ktime_get_ns();
+		memset(skb_put(skb, bench_len), 0xff, bench_len);
+		memcpy(skb->data, &hdr, sizeof(hdr));
+		bench_cb(skb)->hh.prim = PH_DATA_IND;
+		bench_cb(skb)->hh.id = MISDN_ID_ANY;
+		bench_cb(skb)->bch = ch->bch;
+		bench_cb(skb)->lock = ch->lock;
+		bench_cb(skb)->id = hdr.id;
+		bench_cb(skb)->seq = hdr.seq;
+		skb->destructor = bench_destruct;
+		f = &ch->up[hdr.seq % L1LOOP_BENCH_UPRING];
+		f->skb = skb;
+		f->seq = hdr.seq;
+		f->ts_in = hdr.ts;
+		f->ts = 0;
+		__skb_queue_tail(&frames, skb);
+		bench_stats.injected++;
+	}
+	spin_unlock_irqrestore(&bench_lock, flags);
+
+	/*
+	 * queue outside bench_lock, the port lock is taken before bench_lock.
+	 * do not let the queue overflow, the dropped frames would be counted
+	 * as consumed by our destructor.
+	 */
+	while ((skb = __skb_dequeue(&frames))) {
+		bch = bench_cb(skb)->bch;
+		lock = bench_cb(skb)->lock;
+		spin_lock(lock);
+		if (test_bit(FLG_ACTIVE, &bch->Flags) &&
+		    skb_queue_len(&bch->rqueue) < bch->rqueue_max) {
+			recv_Bchannel_skb(bch, skb);
+			skb = NULL;
+		}
+		spin_unlock(lock);
+		if (skb)
+			bench_drop(skb);
+	}
+}
+
+static enum hrtimer_restart
+bench_tick(struct hrtimer *timer)
+{
+	queue_work(system_highpri_wq, &bench_work);
+	hrtimer_forward_now(timer, ns_to_ktime((u64)bench_interval * 1000));
+	return HRTIMER_RESTART;
+}
+
+/*
+ * data sent by the upper layer, find the headers of our frames in it
+ */
+void
+l1loop_bench_tx(struct sk_buff *skb)
+{
+	struct l1loop_bench_chan *ch;
+	struct l1loop_bench_hdr hdr;
+	u64 now = ktime_get_ns();
+	u_long flags;
+	u16 d;
+	int i, off;
+
+	spin_lock_irqsave(&bench_lock, flags);
+	for (off = 0; off + sizeof(hdr) <= skb->len; off++) {
+		if (get_unaligned((u32 *)(skb->data + off)) !=
+		    L1LOOP_BENCH_MAGIC)
+			continue;
+		memcpy(&hdr, skb->data + off, sizeof(hdr));
+		off += sizeof(hdr) - 1;
+		if (hdr.id >= bench_nrchans)
+			continue;
+		ch = bench_chans[hdr.id];
+		if (!ch)
+			continue;
+		d = hdr.seq - ch->rseq;
+		if (d & 0x8000) {
+			bench_stats.late++;
+			continue;
+		}
+		bench_stats.lost += d;
+		bench_stats.returned++;
+		ch->rseq = hdr.seq + 1;
+		bench_count(&bench_stats.rtt, now - hdr.ts);
+		i = hdr.seq % L1LOOP_BENCH_UPRING;
+		if (ch->up[i].ts && ch->up[i].seq == hdr.seq)
+			bench_count(&bench_stats.down, now - ch->up[i].ts);
+	}
+	spin_unlock_irqrestore(&bench_lock, flags);
+	dev_kfree_skb(skb);
+}
+
+void
+l1loop_bench_start(struct bchannel *bch, int instance, spinlock_t *lock)
+{
+	struct l1loop_bench_chan *ch;
+	int id = instance * L1LOOP_BENCH_PORTCH + bch->nr;
+	u_long flags;
+
+	if (!bench_chans || id >= bench_nrchans)
+		return;
+	ch = kzalloc(sizeof(*ch), GFP_KERNEL);
+	if (!ch)
+		return;
+	ch->bch = bch;
+	ch->lock = lock;
+	spin_lock_irqsave(&bench_lock, flags);
+	if (!bench_chans[id]) {
+		bench_chans[id] = ch;
+		ch = NULL;
+	}
+	spin_unlock_irqrestore(&bench_lock, flags);
+	kfree(ch);
+}
+
+void
+l1loop_bench_stop(struct bchannel *bch, int instance)
+{
+	struct l1loop_bench_chan *ch;
+	int id = instance * L1LOOP_BENCH_PORTCH + bch->nr;
+	u_long flags;
+
+	if (!bench_chans || id >= bench_nrchans)
+		return;
+	spin_lock_irqsave(&bench_lock, flags);
+	ch = bench_chans[id];
+	bench_chans[id] = NULL;
+	spin_unlock_irqrestore(&bench_lock, flags);
+	kfree(ch);
+}
+
+static u64
+bench_pct(struct l1loop_bench_hop *hop, int pct)
+{
+	u64 n = div_u64(hop->cnt * pct + 99, 100);
+	u64 sum = 0;
+	int i;
+
+	if (!hop->cnt)
+		return 0;
+	for (i = 0; i < L1LOOP_BENCH_SLOTS - 1; i++) {
+		sum += hop->hist[i];
+		if (sum >= n)
+			break;
+	}
+	return 1ULL << i;
+}
+
+static void
+bench_show_hop(struct seq_file *s, const char *name,
+	       struct l1loop_bench_hop *hop)
+{
+	seq_printf(s, "%-5s %10llu %8llu %8llu %8llu %8llu\n", name,
+		   hop->cnt, bench_pct(hop, 50), bench_pct(hop, 90),
+		   bench_pct(hop, 99), div_u64(hop->max, 1000));
+}
+
+static int
+bench_show(struct seq_file *s, void *v)
+{
+	struct l1loop_bench_hop up, down, rtt;
+	u64 injected, returned, lost, late, dropped, nomem, ms;
+	u_long flags;
+	int i, active = 0;
+
+	spin_lock_irqsave(&bench_lock, flags);
+	for (i = 0; i < bench_nrchans; i++)
+		if (bench_chans[i])
+			active++;
+	ms = ktime_ms_delta(ktime_get(), bench_stats.start);
+	injected = bench_stats.injected;
+	returned = bench_stats.returned;
+	lost = bench_stats.lost;
+	late = bench_stats.late;
+	dropped = bench_stats.dropped;
+	nomem = bench_stats.nomem;
+	up = bench_stats.up;
+	down = bench_stats.down;
+	rtt = bench_stats.rtt;
+	spin_unlock_irqrestore(&bench_lock, flags);
+
+	if (!ms)
+		ms = 1;
+	seq_printf(s, "interval %u us, len %u, channels %d, time %llu ms\n",
+		   bench_interval, bench_len, active, ms);
+	seq_printf(s, "injected %llu (%llu frames/s)\n", injected,
+		   div64_u64(injected * 1000, ms));
+	seq_printf(s, "returned %llu (%llu frames/s)\n", returned,
+		   div64_u64(returned * 1000, ms));
+	seq_printf(s, "lost %llu, late %llu, dropped %llu, nomem %llu\n",
+		   lost, late, dropped, nomem);
+	seq_printf(s, "hop        count   p50_us   p90_us   p99_us   max_us\n");
+	bench_show_hop(s, "up", &up);
+	bench_show_hop(s, "down", &down);
+	bench_show_hop(s, "rtt", &rtt);
+	return 0;
+}
+
+static int
+bench_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, bench_show, NULL);
+}
+
+static ssize_t
+bench_write(struct file *file, const char __user *buf, size_t count,
+	    loff_t *ppos)
+{
+	u_long flags;
+
+	spin_lock_irqsave(&bench_lock, flags);
+	memset(&bench_stats, 0, sizeof(bench_stats));
+	bench_stats.start = ktime_get();
+	spin_unlock_irqrestore(&bench_lock, flags);
+	return count;
+}
+
+static const struct file_operations bench_fops = {
+	.owner		= THIS_MODULE,
+	.open		= bench_open,
+	.read		= seq_read,
+	.write		= bench_write,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
+int
+l1loop_bench_init(u_int interval, u_int len, int nrports)
+{
+	if (len < sizeof(struct l1loop_bench_hdr))
+		len = sizeof(struct l1loop_bench_hdr);
+	if (len > MAX_DATA_MEM)
+		len = MAX_DATA_MEM;
+	bench_interval = interval;
+	bench_len = len;
+	bench_nrchans = nrports * L1LOOP_BENCH_PORTCH;
+	bench_chans = vzalloc(bench_nrchans * sizeof(*bench_chans));
+	if (!bench_chans) {
+		printk(KERN_ERR "%s: no memory for %d channels\n",
+		       __func__, bench_nrchans);
+		return -ENOMEM;
+	}
+	BUILD_BUG_ON(sizeof(struct l1loop_bench_cb) >
+		     FIELD_SIZEOF(struct sk_buff, cb));
+	bench_stats.start = ktime_get();
+
+	bench_dir = debugfs_create_dir("l1loop", NULL);
+	debugfs_create_file("bench", S_IRUSR | S_IWUSR, bench_dir, NULL,
+			    &bench_fops);
+
+	INIT_WORK(&bench_work, bench_inject);
+	hrtimer_init(&bench_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	bench_timer.function = bench_tick;
+	hrtimer_start(&bench_timer, ns_to_ktime((u64)interval * 1000),
+		      HRTIMER_MODE_REL);
+	printk(KERN_INFO "l1loop: benchmark every %u us with %u bytes\n",
+	       interval, len);
+	return 0;
+}
+
+void
+l1loop_bench_cleanup(void)
+{
+	struct l1loop_bench_chan **chans;
+	int i;
+
+	if (!bench_chans)
+		return;
+	hrtimer_cancel(&bench_timer);
+	cancel_work_sync(&bench_work);
+	debugfs_remove_recursive(bench_dir);
+	spin_lock_irq(&bench_lock);
+	chans = bench_chans;
+	bench_chans = NULL;
+	spin_unlock_irq(&bench_lock);
+	for (i = 0; i < bench_nrchans; i++)
+		kfree(chans[i]);
+	vfree(chans);
+}
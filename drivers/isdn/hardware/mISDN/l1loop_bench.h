@@ -0,0 +1,21 @@
+/*
+ * l1loop_bench.h
+ * benchmark mode of the virtual mISDN layer1 driver
+ */
+
+#ifndef __L1LOOP_BENCH_H__
+#define __L1LOOP_BENCH_H__
+
+#include <linux/mISDNhw.h>
+
+/* B-channels per interface in the channel table, nr is 1..127 */
+#define L1LOOP_BENCH_PORTCH	128
+
+extern int l1loop_bench_init(u_int interval, u_int len, int nrports);
+extern void l1loop_bench_cleanup(void);
+extern void l1loop_bench_start(struct bchannel *, int instance,
+			       spinlock_t *lock);
+extern void l1loop_bench_stop(struct bchannel *, int instance);
+extern void l1loop_bench_tx(struct sk_buff *);
+
+#endif /* __L1LOOP_BENCH_H__ */
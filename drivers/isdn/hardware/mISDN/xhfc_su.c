@@ -1652,7 +1652,18 @@ xhfc_read_fifo(struct xhfc *xhfc, __u8 channel)
 	}
 
 	if (rcnt > 0) {
-		if (!(*rx_skb)) {
+		if (bch) {
+			if (bchannel_get_rxbuf(bch, rcnt) < 0) {
+				printk(KERN_INFO "%s: channel(%i) no "
+				       "bufferspace for %i bytes\n",
+				       __FUNCTION__, channel, rcnt);
+				if (*rx_skb)
+					skb_trim(*rx_skb, 0);
+				xhfc_resetfifo(xhfc);
+				spin_unlock(&port->lock);
+				return;
+			}
+		} else if (!(*rx_skb)) {
 			*rx_skb = mI_alloc_skb(maxlen, GFP_ATOMIC);
 			if (!(*rx_skb)) {
 				printk(KERN_INFO "%s: No mem for rx_skb\n",
@@ -17,6 +17,11 @@
 #include <linux/stddef.h>
 #include <linux/module.h>
 #include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/cpumask.h>
+#include <linux/mutex.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 #include <linux/mISDNif.h>
 #include "core.h"
 
@@ -136,6 +141,98 @@ static ssize_t channelmap_show(struct device *dev,
 }
 static DEVICE_ATTR_RO(channelmap);
 
+static ssize_t stack_cpus_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct mISDNdevice *mdev = dev_to_mISDN(dev);
+
+	if (!mdev)
+		return -ENODEV;
+	return sprintf(buf, "%*pbl\n", cpumask_pr_args(mdev->D.st->cpus));
+}
+
+static ssize_t stack_cpus_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct mISDNdevice *mdev = dev_to_mISDN(dev);
+	cpumask_var_t cpus;
+	char *list;
+	int err;
+
+	if (!mdev)
+		return -ENODEV;
+	list = kstrndup(buf, count, GFP_KERNEL);
+	if (!list)
+		return -ENOMEM;
+	if (!alloc_cpumask_var(&cpus, GFP_KERNEL)) {
+		kfree(list);
+		return -ENOMEM;
+	}
+	err = cpulist_parse(strim(list), cpus);
+	if (!err)
+		err = mISDN_stack_set_cpus(mdev->D.st, cpus);
+	free_cpumask_var(cpus);
+	kfree(list);
+
+	return err ? err : count;
+}
+static DEVICE_ATTR_RW(stack_cpus);
+
+static ssize_t stack_prio_show(struct device *dev,
+			       struct device_attribute *attr, char *buf)
+{
+	struct mISDNdevice *mdev = dev_to_mISDN(dev);
+
+	if (!mdev)
+		return -ENODEV;
+	return sprintf(buf, "%d\n", mdev->D.st->prio);
+}
+
+static ssize_t stack_prio_store(struct device *dev,
+				struct device_attribute *attr,
+				const char *buf, size_t count)
+{
+	struct mISDNdevice *mdev = dev_to_mISDN(dev);
+	int prio, err;
+
+	if (!mdev)
+		return -ENODEV;
+	err = kstrtoint(buf, 0, &prio);
+	if (!err)
+		err = mISDN_stack_set_prio(mdev->D.st, prio);
+
+	return err ? err : count;
+}
+static DEVICE_ATTR_RW(stack_prio);
+
+static ssize_t stack_irq_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct mISDNdevice *mdev = dev_to_mISDN(dev);
+
+	if (!mdev)
+		return -ENODEV;
+	return sprintf(buf, "%d\n", mdev->D.st->irq);
+}
+
+static ssize_t stack_irq_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct mISDNdevice *mdev = dev_to_mISDN(dev);
+	int irq, err;
+
+	if (!mdev)
+		return -ENODEV;
+	err = kstrtoint(buf, 0, &irq);
+	if (!err)
+		err = mISDN_stack_set_irq(mdev->D.st, irq);
+
+	return err ? err : count;
+}
+static DEVICE_ATTR_RW(stack_irq);
+
 static struct attribute *mISDN_attrs[] = {
 	&dev_attr_id.attr,
 	&dev_attr_d_protocols.attr,
@@ -144,6 +241,9 @@ static struct attribute *mISDN_attrs[] = {
 	&dev_attr_channelmap.attr,
 	&dev_attr_nrbchan.attr,
 	&dev_attr_name.attr,
+	&dev_attr_stack_cpus.attr,
+	&dev_attr_stack_prio.attr,
+	&dev_attr_stack_irq.attr,
 	NULL,
 };
 ATTRIBUTE_GROUPS(mISDN);
@@ -375,6 +475,103 @@ const char *mISDNDevName4ch(struct mISDNchannel *ch)
 };
 EXPORT_SYMBOL(mISDNDevName4ch);
 
+static LIST_HEAD(mISDN_caches);
+static DEFINE_MUTEX(mISDN_cache_lock);
+struct dentry *mISDN_debugfs;
+
+int
+mISDN_cache_create(struct mISDN_cache *c, const char *name, size_t size,
+		   void (*ctor)(void *))
+{
+	/* a cache with a constructor is never merged */
+	c->cache = kmem_cache_create(name, size, 0, 0, ctor);
+	if (!c->cache) {
+		printk(KERN_ERR "%s: cannot create cache %s\n", __func__, name);
+		return -ENOMEM;
+	}
+	c->name = name;
+	c->size = size;
+	c->ctor = ctor;
+	atomic_long_set(&c->alloc_cnt, 0);
+	atomic_long_set(&c->free_cnt, 0);
+	atomic_long_set(&c->fail_cnt, 0);
+	mutex_lock(&mISDN_cache_lock);
+	list_add_tail(&c->list, &mISDN_caches);
+	mutex_unlock(&mISDN_cache_lock);
+	return 0;
+}
+EXPORT_SYMBOL(mISDN_cache_create);
+
+void
+mISDN_cache_destroy(struct mISDN_cache *c)
+{
+	mutex_lock(&mISDN_cache_lock);
+	list_del(&c->list);
+	mutex_unlock(&mISDN_cache_lock);
+	if (atomic_long_read(&c->alloc_cnt) != atomic_long_read(&c->free_cnt))
+		printk(KERN_WARNING "%s: %s: %ld objects not freed\n",
+		       __func__, c->name, atomic_long_read(&c->alloc_cnt) -
+		       atomic_long_read(&c->free_cnt));
+	kmem_cache_destroy(c->cache);
+	c->cache = NULL;
+}
+EXPORT_SYMBOL(mISDN_cache_destroy);
+
+void *
+mISDN_cache_alloc(struct mISDN_cache *c, gfp_t gfp)
+{
+	void *obj;
+
+	obj = kmem_cache_alloc(c->cache, gfp);
+	if (!obj) {
+		atomic_long_inc(&c->fail_cnt);
+		return NULL;
+	}
+	/* freed objects are not restored, so construct them again */
+	c->ctor(obj);
+	atomic_long_inc(&c->alloc_cnt);
+	return obj;
+}
+EXPORT_SYMBOL(mISDN_cache_alloc);
+
+void
+mISDN_cache_free(struct mISDN_cache *c, void *obj)
+{
+	kmem_cache_free(c->cache, obj);
+	atomic_long_inc(&c->free_cnt);
+}
+EXPORT_SYMBOL(mISDN_cache_free);
+
+static int
+mISDN_caches_show(struct seq_file *m, void *v)
+{
+	struct mISDN_cache *c;
+
+	seq_puts(m, "# name size alloc free fail\n");
+	mutex_lock(&mISDN_cache_lock);
+	list_for_each_entry(c, &mISDN_caches, list)
+		seq_printf(m, "%s %zu %ld %ld %ld\n", c->name, c->size,
+			   atomic_long_read(&c->alloc_cnt),
+			   atomic_long_read(&c->free_cnt),
+			   atomic_long_read(&c->fail_cnt));
+	mutex_unlock(&mISDN_cache_lock);
+	return 0;
+}
+
+static int
+mISDN_caches_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, mISDN_caches_show, NULL);
+}
+
+static const struct file_operations mISDN_caches_fops = {
+	.owner		= THIS_MODULE,
+	.open		= mISDN_caches_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int
 mISDNInit(void)
 {
@@ -399,6 +596,9 @@ mISDNInit(void)
 	err = misdn_sock_init(&debug);
 	if (err)
 		goto error5;
+	mISDN_debugfs = debugfs_create_dir("mISDN", NULL);
+	debugfs_create_file("caches", S_IRUSR, mISDN_debugfs, NULL,
+			    &mISDN_caches_fops);
 	return 0;
 
 error5:
@@ -415,6 +615,7 @@ error1:
 
 static void mISDN_cleanup(void)
 {
+	debugfs_remove_recursive(mISDN_debugfs);
 	misdn_sock_cleanup();
 	Isdnl2_cleanup();
 	l1_cleanup();
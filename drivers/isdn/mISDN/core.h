@@ -56,11 +56,16 @@ extern int	create_teimanager(struct mISDNdevice *);
 extern void	delete_teimanager(struct mISDNchannel *);
 extern void	delete_channel(struct mISDNchannel *);
 extern void	delete_stack(struct mISDNdevice *);
+extern int	mISDN_stack_set_cpus(struct mISDNstack *,
+				     const struct cpumask *);
+extern int	mISDN_stack_set_prio(struct mISDNstack *, int);
+extern int	mISDN_stack_set_irq(struct mISDNstack *, int);
 extern void	mISDN_initstack(u_int *);
 extern int      misdn_sock_init(u_int *);
 extern void     misdn_sock_cleanup(void);
 extern void	add_layer2(struct mISDNchannel *, struct mISDNstack *);
 extern void	__add_layer2(struct mISDNchannel *, struct mISDNstack *);
+extern void	__del_layer2(struct mISDNchannel *, struct mISDNstack *);
 
 extern u_int		get_all_Bprotocols(void);
 struct Bprotocol	*get_Bprotocol4mask(u_int);
@@ -76,4 +81,28 @@ extern void	Isdnl2_cleanup(void);
 
 extern void	mISDN_init_clock(u_int *);
 
+extern struct dentry	*mISDN_debugfs;
+
+/*
+ * object caches of the core and the dsp module, they always have a
+ * constructor, so the slab allocator never merges them with other caches,
+ * the constructor is run again on every allocation
+ */
+struct mISDN_cache {
+	struct kmem_cache	*cache;
+	const char		*name;
+	size_t			size;
+	void			(*ctor)(void *);
+	atomic_long_t		alloc_cnt;
+	atomic_long_t		free_cnt;
+	atomic_long_t		fail_cnt;
+	struct list_head	list;
+};
+
+extern int	mISDN_cache_create(struct mISDN_cache *, const char *, size_t,
+				   void (*)(void *));
+extern void	mISDN_cache_destroy(struct mISDN_cache *);
+extern void	*mISDN_cache_alloc(struct mISDN_cache *, gfp_t);
+extern void	mISDN_cache_free(struct mISDN_cache *, void *);
+
 #endif
@@ -28,6 +28,8 @@
 #define DSP_OPT_NOHARDWARE	(1 << 1)
 
 #include <linux/timer.h>
+#include <linux/hrtimer.h>
+#include <linux/interrupt.h>
 #include <linux/workqueue.h>
 
 #include "dsp_ecdis.h"
@@ -36,7 +38,7 @@ extern int dsp_options;
 extern int dsp_debug;
 extern int dsp_poll;
 extern int dsp_tics;
-extern spinlock_t dsp_lock;
+extern rwlock_t dsp_lock;
 extern struct work_struct dsp_workq;
 extern u32 dsp_poll_diff; /* calculated fix-comma corrected poll value */
 
@@ -80,6 +82,80 @@ extern struct timer_list dsp_spl_tl;
 /* the datatype need to match jiffies datatype */
 extern unsigned long dsp_spl_jiffies;
 
+/* high resolution clock, see hrclock parameter of dsp_core.c */
+extern struct hrtimer dsp_spl_hrtimer;
+extern ktime_t dsp_spl_period;
+extern struct tasklet_struct dsp_spl_tasklet;
+
+/*
+ * buffers to mix a conference in linear samples, see dsp_mix.c
+ */
+struct dsp_mix_buffer {
+	s32	sum[MAX_POLL + 100]; /* sum of all members */
+	s16	tx[MAX_POLL + 100]; /* tx-data of the current member */
+	s16	out[MAX_POLL + 100]; /* result of the current member */
+};
+
+/*
+ * cmx workers:
+ *
+ * if enabled, each conference and each dsp without conference is assigned
+ * to one of the workers. the timer only hands out the number of samples to
+ * process, the workers do the mixing on their cpus in parallel. they hold
+ * dsp_lock for reading and their own lock.
+ * each worker has a list of its conferences and of its dsp instances, it only
+ * walks these. a dsp instance that is member of a conference is mixed by the
+ * worker of the conference. the lists are changed with dsp_lock held for
+ * writing.
+ */
+#define MAX_CMX_WORKERS	64
+
+/* common part of the cmx and ec workers, must be their first member */
+struct dsp_worker {
+	struct work_struct	work;
+	int			nr;
+	int			cpu; /* cpu to run on */
+};
+
+struct dsp_cmx_worker {
+	struct dsp_worker	w;
+	spinlock_t		lock; /* protects the mix buffer */
+	atomic_t		length; /* samples to process */
+	unsigned long		jittercheck; /* bit 0 set: check jitter */
+	struct list_head	dsps; /* dsp instances of this worker */
+	struct list_head	confs; /* conferences of this worker */
+	struct dsp_mix_buffer	mix;
+} ____cacheline_aligned_in_smp;
+
+extern int dsp_cmx_workers;
+extern struct dsp_cmx_worker *dsp_cmx_worker;
+
+/*
+ * ec workers:
+ *
+ * if enabled, the received data of a dsp instance with a pipeline is not
+ * processed in the rx path, but queued at the worker of the instance. the
+ * worker runs the pipelines of all queued frames in one fpu section and
+ * then finishes the rx path of the frames in order of arrival.
+ */
+#define MAX_EC_WORKERS	64
+
+struct dsp_ec_worker {
+	struct dsp_worker	w;
+	struct sk_buff_head	queue; /* received frames to process */
+} ____cacheline_aligned_in_smp;
+
+/* a queued frame carries its dsp behind the mISDN head */
+struct dsp_ec_cb {
+	struct mISDNhead	hh;
+	struct dsp		*dsp;
+	unsigned int		tx_count; /* pipeline tx count at reception */
+};
+
+#define DSP_EC_CB(s)	((struct dsp_ec_cb *)&(s)->cb[0])
+
+extern int dsp_ec_workers;
+
 /* the structure of conferences:
  *
  * each conference has a unique number, given by user space.
@@ -102,9 +178,14 @@ struct dsp_conf {
 	/* all cmx stacks with the same ID are
 	   connected */
 	struct list_head	mlist;
+	int			count; /* number of members */
+	int			size; /* size of members table */
+	struct dsp		**members; /* members table for mixing */
 	int			software; /* conf is processed by software */
 	int			hardware; /* conf is processed by hardware */
 	/* note: if both unset, has only one member */
+	int			worker; /* cmx worker that mixes this conf */
+	struct list_head	cmx_list; /* in the list of the worker */
 };
 
 
@@ -135,9 +216,10 @@ struct dsp_dtmf {
  * pipeline stuff *
  ******************/
 struct dsp_pipeline {
-	rwlock_t  lock;
+	spinlock_t lock; /* rx and tx elements may share state */
 	struct list_head list;
 	int inuse;
+	unsigned int tx_count; /* samples passed to the tx elements */
 };
 
 /***************
@@ -167,6 +249,8 @@ struct dsp_echo {
  * general stuff *
  *****************/
 
+struct bf_ctx;
+
 struct dsp {
 	struct list_head list;
 	struct mISDNchannel	ch;
@@ -192,8 +276,22 @@ struct dsp {
 	struct dsp_conf	*conf;
 	struct dsp_conf_member
 	*member;
-
-	/* buffer stuff */
+	int		cmx_worker; /* cmx worker, if not member of a conf */
+	struct list_head cmx_list; /* in the list of the cmx worker */
+	int		ec_worker; /* ec worker that runs the rx pipeline */
+	atomic_t	ec_queued; /* frames queued at the ec worker */
+
+	/*
+	 * buffer stuff:
+	 * rx_buff and tx_buff are single producer/single consumer rings.
+	 * the write pointers are only changed by the producer (card rx and
+	 * upper layer tx), the read pointers only by the cmx. both publish
+	 * their pointer with smp_store_release(). only a resync of the rx
+	 * pointers requires dsp_lock for writing.
+	 * tx_buff only exists for transparent data, rx_buff only while the
+	 * dsp is member of a conference, if rx_buff is NULL there is no
+	 * rx-data.
+	 */
 	int		rx_W; /* current write pos for data without timestamp */
 	int		rx_R; /* current read pos for transmit clock */
 	int		rx_init; /* if set, pointers will be adjusted first */
@@ -201,8 +299,10 @@ struct dsp {
 	int		tx_R; /* current read pos for transmit clock */
 	int		rx_delay[MAX_SECONDS_JITTER_CHECK];
 	int		tx_delay[MAX_SECONDS_JITTER_CHECK];
-	u8		tx_buff[CMX_BUFF_SIZE];
-	u8		rx_buff[CMX_BUFF_SIZE];
+	u8		*tx_buff;
+	u8		*rx_buff;
+	u8		*rx_spare; /* rx ring for a join, allocated before dsp_lock */
+	s16		rx_lin[MAX_POLL + 100]; /* rx-data of conf mixing */
 	int		last_tx; /* if set, we transmitted last poll interval */
 	int		cmx_delay; /* initial delay of buffers,
 				      or 0 for dynamic jitter buffer */
@@ -221,8 +321,7 @@ struct dsp {
 
 	/* encryption stuff */
 	int		bf_enable;
-	u32		bf_p[18];
-	u32		bf_s[1024];
+	struct bf_ctx	*bf; /* allocated when a key is set */
 	int		bf_crypt_pos;
 	u8		bf_data_in[9];
 	u8		bf_crypt_out[9];
@@ -239,18 +338,57 @@ struct dsp {
 /* functions */
 
 extern void dsp_change_volume(struct sk_buff *skb, int volume);
+extern void dsp_audio_decode(s16 *lin, const u8 *law, int len);
+extern void dsp_audio_encode(u8 *law, const s16 *lin, int len);
 
 extern struct list_head dsp_ilist;
 extern struct list_head conf_ilist;
 extern void dsp_cmx_debug(struct dsp *dsp);
 extern void dsp_cmx_hardware(struct dsp_conf *conf, struct dsp *dsp);
 extern int dsp_cmx_conf(struct dsp *dsp, u32 conf_id);
-extern void dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb);
+extern int dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb, int resync);
 extern void dsp_cmx_hdlc(struct dsp *dsp, struct sk_buff *skb);
 extern void dsp_cmx_send(void *arg);
+extern u8 *dsp_cmx_ring_alloc(gfp_t gfp);
+extern void dsp_cmx_ring_free(u8 *ring);
+extern int dsp_cmx_init_caches(void);
+extern void dsp_cmx_cleanup_caches(void);
+extern enum hrtimer_restart dsp_cmx_hrsend(struct hrtimer *timer);
 extern void dsp_cmx_transmit(struct dsp *dsp, struct sk_buff *skb);
 extern int dsp_cmx_del_conf_member(struct dsp *dsp);
 extern int dsp_cmx_del_conf(struct dsp_conf *conf);
+#define DSP_MIX_SCALAR	0
+#define DSP_MIX_SSE2	1
+#define DSP_MIX_AVX2	2
+extern int dsp_mix_level;
+extern const s16 dsp_mix_silence[MAX_POLL + 100];
+extern void dsp_mix_init(void);
+#ifdef CONFIG_X86_64
+extern int dsp_fpu_batch_begin(void);
+extern void dsp_fpu_batch_end(int fpu);
+#else
+static inline int dsp_fpu_batch_begin(void)
+{
+	return 0;
+}
+
+static inline void dsp_fpu_batch_end(int fpu)
+{
+}
+#endif
+extern void dsp_mix_decode(s16 *lin, const u8 *buff, int pos, int len);
+extern void dsp_mix_sum(s32 *sum, const s16 *lin, int len);
+extern void dsp_mix_member(s16 *out, const s32 *sum, const s16 *sub,
+			   const s16 *add, int len);
+extern int dsp_cmx_assign_worker(void);
+extern void dsp_cmx_add_worker_dsp(struct dsp *dsp);
+extern void dsp_cmx_del_worker_dsp(struct dsp *dsp);
+extern int dsp_cmx_init_workers(int count);
+extern void *dsp_workers_alloc(int *count, int max, size_t size,
+			       work_func_t func);
+extern void dsp_worker_queue(struct workqueue_struct *wq,
+			     struct dsp_worker *w);
+extern void dsp_cmx_cleanup_workers(void);
 
 extern void dsp_dtmf_goertzel_init(struct dsp *dsp);
 extern void dsp_dtmf_hardware(struct dsp *dsp);
@@ -274,4 +412,11 @@ extern int  dsp_pipeline_build(struct dsp_pipeline *pipeline, const char *cfg);
 extern void dsp_pipeline_process_tx(struct dsp_pipeline *pipeline, u8 *data,
 				    int len);
 extern void dsp_pipeline_process_rx(struct dsp_pipeline *pipeline, u8 *data,
-				    int len, unsigned int txlen);
+				    int len, unsigned int txlen,
+				    unsigned int tx_count);
+extern int  dsp_ec_assign_worker(void);
+extern int  dsp_ec_init_workers(int count);
+extern void dsp_ec_cleanup_workers(void);
+extern void dsp_ec_queue(struct dsp *dsp, struct sk_buff *skb);
+extern void dsp_ec_flush(struct dsp *dsp);
+extern int  dsp_rx_finish(struct dsp *dsp, struct sk_buff *skb);
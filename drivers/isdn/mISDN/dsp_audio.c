@@ -16,6 +16,9 @@
 #include <linux/bitrev.h>
 #include "core.h"
 #include "dsp.h"
+#ifdef CONFIG_X86_64
+#include <asm/fpu/api.h>
+#endif
 
 /* ulaw[unsigned char] -> signed 16-bit */
 s32 dsp_audio_ulaw_to_s32[256];
@@ -60,6 +63,9 @@ static inline unsigned char linear2alaw(short int linear)
 		/* Sign bit = 0 */
 		mask = AMI_MASK;
 		pcm_val = -pcm_val;
+		/* -32768 would overflow the segments */
+		if (pcm_val > 0x7FFF)
+			pcm_val = 0x7FFF;
 	}
 
 	/* Convert the scaled magnitude to segment number. */
@@ -102,6 +108,7 @@ static inline short int ulaw2linear(unsigned char ulaw)
 }
 
 #define BIAS 0x84   /*!< define the add-in bias for 16 bit samples */
+#define CLIP 32635  /*!< maximum magnitude, so the bias will not overflow */
 
 static unsigned char linear2ulaw(short sample)
 {
@@ -122,23 +129,215 @@ static unsigned char linear2ulaw(short sample)
 		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
 		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7,
 		7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7, 7};
-	int sign, exponent, mantissa;
+	int sign, exponent, mantissa, mag;
 	unsigned char ulawbyte;
 
 	/* Get the sample into sign-magnitude. */
-	sign = (sample >> 8) & 0x80;	  /* set aside the sign */
+	mag = sample;
+	sign = (mag >> 8) & 0x80;	  /* set aside the sign */
 	if (sign != 0)
-		sample = -sample;	      /* get magnitude */
+		mag = -mag;		  /* get magnitude */
+	if (mag > CLIP)
+		mag = CLIP;
 
 	/* Convert from 16 bit linear to ulaw. */
-	sample = sample + BIAS;
-	exponent = exp_lut[(sample >> 7) & 0xFF];
-	mantissa = (sample >> (exponent + 3)) & 0x0F;
+	mag = mag + BIAS;
+	exponent = exp_lut[(mag >> 7) & 0xFF];
+	mantissa = (mag >> (exponent + 3)) & 0x0F;
 	ulawbyte = ~(sign | (exponent << 4) | mantissa);
 
 	return ulawbyte;
 }
 
+/*************************************************
+ * bulk conversion of law from/to linear samples *
+ *************************************************/
+
+#ifdef CONFIG_X86_64
+/*
+ * The encoder calculates the law without the 64k table. alaw and ulaw
+ * only differ in clipping, bias, the minimum segment of the mantissa
+ * shift and the final xor, see linear2alaw() and linear2ulaw().
+ * The segment is taken from the exponent of the sample converted to
+ * float, the result is bit reversed by two nibble lookups.
+ */
+struct dsp_audio_enc {
+	s32	clip;	/* maximum magnitude */
+	s32	bias;
+	s32	minseg;	/* the mantissa is shifted by at least minseg + 3 */
+	s32	xpos;	/* xor of positive samples */
+	s32	xsign;	/* xpos ^ xor of negative samples */
+};
+
+static const struct dsp_audio_enc dsp_audio_enc_alaw = {
+	0x7fff, 0, 1, AMI_MASK | 0x80, 0x80
+};
+
+static const struct dsp_audio_enc dsp_audio_enc_ulaw = {
+	CLIP, BIAS, 0, 0xff, 0x80
+};
+
+static const struct dsp_audio_enc *dsp_audio_enc;
+
+/* 0xff, float exponent of 128, 3, 0x0f */
+static const s32 dsp_audio_enc_const[4] = { 0xff, 127 + 7, 3, 0x0f };
+static const u8 dsp_audio_nibble_mask[16] = {
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f,
+	0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f, 0x0f
+};
+/* reversed nibble, in the low and in the high nibble */
+static const u8 dsp_audio_nibble_rev[16] = {
+	0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe,
+	0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+};
+static const u8 dsp_audio_nibble_rev4[16] = {
+	0x00, 0x80, 0x40, 0xc0, 0x20, 0xa0, 0x60, 0xe0,
+	0x10, 0x90, 0x50, 0xd0, 0x30, 0xb0, 0x70, 0xf0
+};
+
+/*
+ * returns the number of samples processed by simd, the remaining samples
+ * must be processed by the scalar loop
+ */
+static int
+dsp_audio_decode_avx2(s16 *lin, const u8 *law, int len)
+{
+	int i;
+
+	/* the gather from the 1k table replaces eight loads */
+	for (i = 0; i + 8 <= len; i += 8) {
+		asm volatile(
+			"vpmovzxbd (%1), %%ymm0\n\t"
+			"vpcmpeqd %%ymm1, %%ymm1, %%ymm1\n\t"
+			"vpxor %%ymm2, %%ymm2, %%ymm2\n\t"
+			"vpgatherdd %%ymm1, (%2,%%ymm0,4), %%ymm2\n\t"
+			"vextracti128 $1, %%ymm2, %%xmm3\n\t"
+			"vpackssdw %%xmm3, %%xmm2, %%xmm2\n\t"
+			"vmovdqu %%xmm2, (%0)\n\t"
+			: : "r" (lin + i), "r" (law + i),
+			  "r" (dsp_audio_law_to_s32)
+			: "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+	}
+	asm volatile("vzeroupper" : : : "memory");
+	return i;
+}
+
+static int
+dsp_audio_encode_avx2(u8 *law, const s16 *lin, int len)
+{
+	const struct dsp_audio_enc *enc = dsp_audio_enc;
+	int i;
+
+	for (i = 0; i + 8 <= len; i += 8) {
+		asm volatile(
+			/* magnitude, clipped and biased */
+			"vpmovsxwd (%[lin]), %%ymm0\n\t"
+			"vpabsd %%ymm0, %%ymm1\n\t"
+			"vpbroadcastd %[clip], %%ymm2\n\t"
+			"vpminsd %%ymm2, %%ymm1, %%ymm1\n\t"
+			"vpbroadcastd %[bias], %%ymm2\n\t"
+			"vpaddd %%ymm2, %%ymm1, %%ymm1\n\t"
+			/* segment from the float exponent of (mag | 0xff) */
+			"vpbroadcastd %[c0], %%ymm2\n\t"
+			"vpor %%ymm2, %%ymm1, %%ymm3\n\t"
+			"vcvtdq2ps %%ymm3, %%ymm3\n\t"
+			"vpsrld $23, %%ymm3, %%ymm3\n\t"
+			"vpbroadcastd %[c1], %%ymm2\n\t"
+			"vpsubd %%ymm2, %%ymm3, %%ymm3\n\t"
+			/* mantissa */
+			"vpbroadcastd %[minseg], %%ymm2\n\t"
+			"vpmaxsd %%ymm2, %%ymm3, %%ymm4\n\t"
+			"vpbroadcastd %[c2], %%ymm2\n\t"
+			"vpaddd %%ymm2, %%ymm4, %%ymm4\n\t"
+			"vpsrlvd %%ymm4, %%ymm1, %%ymm1\n\t"
+			"vpbroadcastd %[c3], %%ymm2\n\t"
+			"vpand %%ymm2, %%ymm1, %%ymm1\n\t"
+			"vpslld $4, %%ymm3, %%ymm3\n\t"
+			"vpor %%ymm3, %%ymm1, %%ymm1\n\t"
+			/* xor depending on the sign */
+			"vpsrad $31, %%ymm0, %%ymm0\n\t"
+			"vpbroadcastd %[xsign], %%ymm2\n\t"
+			"vpand %%ymm2, %%ymm0, %%ymm0\n\t"
+			"vpbroadcastd %[xpos], %%ymm2\n\t"
+			"vpxor %%ymm2, %%ymm0, %%ymm0\n\t"
+			"vpxor %%ymm0, %%ymm1, %%ymm1\n\t"
+			/* pack to bytes */
+			"vextracti128 $1, %%ymm1, %%xmm2\n\t"
+			"vpackusdw %%xmm2, %%xmm1, %%xmm1\n\t"
+			"vpackuswb %%xmm1, %%xmm1, %%xmm1\n\t"
+			/* bit reverse */
+			"vmovdqu %[mask], %%xmm3\n\t"
+			"vpand %%xmm3, %%xmm1, %%xmm2\n\t"
+			"vpsrlw $4, %%xmm1, %%xmm1\n\t"
+			"vpand %%xmm3, %%xmm1, %%xmm1\n\t"
+			"vmovdqu %[rev4], %%xmm4\n\t"
+			"vpshufb %%xmm2, %%xmm4, %%xmm2\n\t"
+			"vmovdqu %[rev], %%xmm4\n\t"
+			"vpshufb %%xmm1, %%xmm4, %%xmm1\n\t"
+			"vpor %%xmm2, %%xmm1, %%xmm1\n\t"
+			"vmovq %%xmm1, (%[law])\n\t"
+			: : [law] "r" (law + i), [lin] "r" (lin + i),
+			  [clip] "m" (enc->clip), [bias] "m" (enc->bias),
+			  [minseg] "m" (enc->minseg), [xpos] "m" (enc->xpos),
+			  [xsign] "m" (enc->xsign),
+			  [c0] "m" (dsp_audio_enc_const[0]),
+			  [c1] "m" (dsp_audio_enc_const[1]),
+			  [c2] "m" (dsp_audio_enc_const[2]),
+			  [c3] "m" (dsp_audio_enc_const[3]),
+			  [mask] "m" (dsp_audio_nibble_mask),
+			  [rev] "m" (dsp_audio_nibble_rev),
+			  [rev4] "m" (dsp_audio_nibble_rev4)
+			: "memory", "xmm0", "xmm1", "xmm2", "xmm3", "xmm4");
+	}
+	asm volatile("vzeroupper" : : : "memory");
+	return i;
+}
+#endif
+
+/*
+ * decode len law samples to linear samples
+ */
+void
+dsp_audio_decode(s16 *lin, const u8 *law, int len)
+{
+	int i = 0;
+
+#ifdef CONFIG_X86_64
+	if (dsp_mix_level == DSP_MIX_AVX2 && len >= 8) {
+		int fpu = dsp_fpu_begin();
+
+		if (fpu)
+			i = dsp_audio_decode_avx2(lin, law, len);
+		dsp_fpu_end(fpu);
+	}
+#endif
+	for (; i < len; i++)
+		lin[i] = dsp_audio_law_to_s32[law[i]];
+}
+EXPORT_SYMBOL(dsp_audio_decode);
+
+/*
+ * encode len linear samples to law
+ */
+void
+dsp_audio_encode(u8 *law, const s16 *lin, int len)
+{
+	int i = 0;
+
+#ifdef CONFIG_X86_64
+	if (dsp_mix_level == DSP_MIX_AVX2 && len >= 8) {
+		int fpu = dsp_fpu_begin();
+
+		if (fpu)
+			i = dsp_audio_encode_avx2(law, lin, len);
+		dsp_fpu_end(fpu);
+	}
+#endif
+	for (; i < len; i++)
+		law[i] = dsp_audio_s16_to_law[(u16)lin[i]];
+}
+EXPORT_SYMBOL(dsp_audio_encode);
+
 void dsp_audio_generate_law_tables(void)
 {
 	int i;
@@ -161,6 +360,10 @@ dsp_audio_generate_s2law_table(void)
 {
 	int i;
 
+#ifdef CONFIG_X86_64
+	dsp_audio_enc = (dsp_options & DSP_OPT_ULAW) ?
+		&dsp_audio_enc_ulaw : &dsp_audio_enc_alaw;
+#endif
 	if (dsp_options & DSP_OPT_ULAW) {
 		/* generating ulaw-table */
 		for (i = -32768; i < 32768; i++) {
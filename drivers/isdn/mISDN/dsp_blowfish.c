@@ -8,6 +8,7 @@
  *
  */
 
+#include <linux/slab.h>
 #include <linux/mISDNif.h>
 #include <linux/mISDNdsp.h>
 #include "core.h"
@@ -371,8 +372,8 @@ dsp_bf_encrypt(struct dsp *dsp, u8 *data, int len)
 	int i = 0, j = dsp->bf_crypt_pos;
 	u8 *bf_data_in = dsp->bf_data_in;
 	u8 *bf_crypt_out = dsp->bf_crypt_out;
-	u32 *P = dsp->bf_p;
-	u32 *S = dsp->bf_s;
+	u32 *P = dsp->bf->p;
+	u32 *S = dsp->bf->s;
 	u32 yl, yr;
 	u32 cs;
 	u8 nibble;
@@ -463,8 +464,8 @@ dsp_bf_decrypt(struct dsp *dsp, u8 *data, int len)
 	u8 *bf_crypt_inring = dsp->bf_crypt_inring;
 	u8 *bf_data_out = dsp->bf_data_out;
 	u16 sync = dsp->bf_sync;
-	u32 *P = dsp->bf_p;
-	u32 *S = dsp->bf_s;
+	u32 *P = dsp->bf->p;
+	u32 *S = dsp->bf->s;
 	u32 yl, yr;
 	u8 nibble;
 	u8 cs, cs0, cs1, cs2;
@@ -600,12 +601,22 @@ dsp_bf_init(struct dsp *dsp, const u8 *key, uint keylen)
 {
 	short i, j, count;
 	u32 data[2], temp;
-	u32 *P = (u32 *)dsp->bf_p;
-	u32 *S = (u32 *)dsp->bf_s;
+	u32 *P, *S;
 
 	if (keylen < 4 || keylen > 56)
 		return 1;
 
+	if (!dsp->bf) {
+		/* called with dsp_lock held */
+		dsp->bf = kmalloc(sizeof(struct bf_ctx), GFP_ATOMIC);
+		if (!dsp->bf) {
+			printk(KERN_ERR "kmalloc struct bf_ctx failed\n");
+			return -ENOMEM;
+		}
+	}
+	P = dsp->bf->p;
+	S = dsp->bf->s;
+
 	/* Set dsp states */
 	i = 0;
 	while (i < 9) {
@@ -669,4 +680,6 @@ void
 dsp_bf_cleanup(struct dsp *dsp)
 {
 	dsp->bf_enable = 0;
+	kfree(dsp->bf);
+	dsp->bf = NULL;
 }
@@ -110,11 +110,14 @@ static inline void dsp_cancel_tx(struct ec_prv *p, u8 *data, int len)
 	p->tx_W = w;
 }
 
+/* samples that are converted at once */
+#define ECHOCAN_CHUNK 64
+
 /** Processes one TX- and one RX-packet with echocancellation */
 static inline void dsp_cancel_rx(struct ec_prv *p, u8 *data, int len, unsigned int txlen)
 {
-	int16_t	rxlin, txlin;
-	int	r;
+	s16	rxlin[ECHOCAN_CHUNK], txlin[ECHOCAN_CHUNK];
+	int	r, n, c, i;
 	u8	*s;
 
 	if (!p || !data)
@@ -126,41 +129,49 @@ static inline void dsp_cancel_rx(struct ec_prv *p, u8 *data, int len, unsigned i
 	s = p->txbuff;
 	/* calculation V0.1 : 'len' and 'txlen' samples off the end */
 	r = (p->tx_W - len - txlen) & ECHOCAN_BUFF_MASK;
-	kernel_fpu_begin();
-	if (p->echostate & __ECHO_STATE_MUTE) {
-		/* Special stuff for training the echo can */
-		while (len--) {
-			rxlin = dsp_audio_law_to_s32[*data];
-			txlin = dsp_audio_law_to_s32[s[r]];
-			if (p->echostate == ECHO_STATE_PRETRAINING) {
-				if (--p->echotimer <= 0) {
-					p->echotimer = 0;
-					p->echostate = ECHO_STATE_STARTTRAINING;
+	while (len) {
+		n = (len > ECHOCAN_CHUNK) ? ECHOCAN_CHUNK : len;
+		c = ECHOCAN_BUFF_SIZE - r;
+		if (c > n)
+			c = n;
+		dsp_audio_decode(rxlin, data, n);
+		dsp_audio_decode(txlin, s + r, c);
+		if (c < n)
+			dsp_audio_decode(txlin + c, s, n - c);
+		r = (r + n) & ECHOCAN_BUFF_MASK;
+		len -= n;
+		if (p->echostate & __ECHO_STATE_MUTE) {
+			/* Special stuff for training the echo can */
+			kernel_fpu_begin();
+			for (i = 0; i < n; i++) {
+				if (p->echostate == ECHO_STATE_PRETRAINING) {
+					if (--p->echotimer <= 0) {
+						p->echotimer = 0;
+						p->echostate =
+							ECHO_STATE_STARTTRAINING;
+					}
 				}
-			}
-			if ((p->echostate == ECHO_STATE_AWAITINGECHO) &&
-			    (txlin > 8000)) {
-				p->echolastupdate = 0;
-				p->echostate = ECHO_STATE_TRAINING;
-			}
-			if (p->echostate == ECHO_STATE_TRAINING) {
-				if (echo_can_traintap(p->ec,
-				    p->echolastupdate++, rxlin)) {
-					p->echostate = ECHO_STATE_ACTIVE;
+				if ((p->echostate == ECHO_STATE_AWAITINGECHO) &&
+				    (txlin[i] > 8000)) {
+					p->echolastupdate = 0;
+					p->echostate = ECHO_STATE_TRAINING;
+				}
+				if (p->echostate == ECHO_STATE_TRAINING) {
+					if (echo_can_traintap(p->ec,
+					    p->echolastupdate++, rxlin[i])) {
+						p->echostate = ECHO_STATE_ACTIVE;
+					}
 				}
 			}
-			rxlin = 0;
-			*data++ = dsp_audio_s16_to_law[rxlin & 0xffff];
-			r = (r + 1) & ECHOCAN_BUFF_MASK;
-		}
-	} else {
-		while (len--) {
-			rxlin = dsp_audio_law_to_s32[*data];
-			txlin = dsp_audio_law_to_s32[s[r]];
-			rxlin = echo_can_update(p->ec, txlin, rxlin);
-			*data++ = dsp_audio_s16_to_law[rxlin & 0xffff];
-			r = (r + 1) & ECHOCAN_BUFF_MASK;
+			kernel_fpu_end();
+			memset(data, dsp_audio_s16_to_law[0], n);
+		} else {
+			/* the canceller writes its output over rxlin */
+			kernel_fpu_begin();
+			echo_can_update_block(p->ec, txlin, rxlin, rxlin, n);
+			kernel_fpu_end();
+			dsp_audio_encode(data, rxlin, n);
 		}
+		data += n;
 	}
-	kernel_fpu_end();
 }
@@ -13,6 +13,8 @@
  *
  * There is a chain of struct dsp_conf which has one or more members in a chain
  * of struct dsp_conf_member.
+ * For mixing, each conference also holds a table of its members and their
+ * count, so that the mixing does not need to walk the chain.
  *
  * After a party is added, the conference is checked for hardware capability.
  * Also if a party is removed, the conference is checked again.
@@ -126,6 +128,7 @@
 
 #include <linux/slab.h>
 #include <linux/delay.h>
+#include <linux/cpumask.h>
 #include <linux/mISDNif.h>
 #include <linux/mISDNdsp.h>
 #include "core.h"
@@ -141,17 +144,6 @@
 /*#define CMX_DELAY_DEBUG * gives rx-buffer delay overview */
 /*#define CMX_TX_DEBUG * massive read/write on tx-buffer with content */
 
-static inline int
-count_list_member(struct list_head *head)
-{
-	int			cnt = 0;
-	struct list_head	*m;
-
-	list_for_each(m, head)
-		cnt++;
-	return cnt;
-}
-
 /*
  * debug cmx memory structure
  */
@@ -191,6 +183,88 @@ dsp_cmx_debug(struct dsp *dsp)
 	printk(KERN_DEBUG "-----end\n");
 }
 
+/*
+ * rx and tx rings are allocated from a cache, only if they are used
+ * conferences and their members come from own caches too, they are
+ * allocated in atomic context on every join
+ */
+static struct mISDN_cache dsp_ring_cache;
+static struct mISDN_cache dsp_conf_cache;
+static struct mISDN_cache dsp_member_cache;
+
+static void
+dsp_ring_ctor(void *obj)
+{
+	memset(obj, 0, CMX_BUFF_SIZE);
+}
+
+static void
+dsp_conf_ctor(void *obj)
+{
+	struct dsp_conf *conf = obj;
+
+	memset(conf, 0, sizeof(*conf));
+	INIT_LIST_HEAD(&conf->mlist);
+}
+
+static void
+dsp_member_ctor(void *obj)
+{
+	struct dsp_conf_member *member = obj;
+
+	memset(member, 0, sizeof(*member));
+	INIT_LIST_HEAD(&member->list);
+}
+
+u8 *
+dsp_cmx_ring_alloc(gfp_t gfp)
+{
+	return mISDN_cache_alloc(&dsp_ring_cache, gfp);
+}
+
+void
+dsp_cmx_ring_free(u8 *ring)
+{
+	if (ring)
+		mISDN_cache_free(&dsp_ring_cache, ring);
+}
+
+int
+dsp_cmx_init_caches(void)
+{
+	int err;
+
+	err = mISDN_cache_create(&dsp_ring_cache, "mISDN_dsp_ring",
+				 CMX_BUFF_SIZE, dsp_ring_ctor);
+	if (err)
+		goto err_ring;
+	err = mISDN_cache_create(&dsp_conf_cache, "mISDN_dsp_conf",
+				 sizeof(struct dsp_conf), dsp_conf_ctor);
+	if (err)
+		goto err_conf;
+	err = mISDN_cache_create(&dsp_member_cache, "mISDN_dsp_member",
+				 sizeof(struct dsp_conf_member),
+				 dsp_member_ctor);
+	if (err)
+		goto err_member;
+	return 0;
+
+err_member:
+	mISDN_cache_destroy(&dsp_conf_cache);
+err_conf:
+	mISDN_cache_destroy(&dsp_ring_cache);
+err_ring:
+	return err;
+}
+
+void
+dsp_cmx_cleanup_caches(void)
+{
+	mISDN_cache_destroy(&dsp_member_cache);
+	mISDN_cache_destroy(&dsp_conf_cache);
+	mISDN_cache_destroy(&dsp_ring_cache);
+}
+
 /*
  * search conference
  */
@@ -220,6 +294,8 @@ static int
 dsp_cmx_add_conf_member(struct dsp *dsp, struct dsp_conf *conf)
 {
 	struct dsp_conf_member *member;
+	struct dsp **members;
+	int size;
 
 	if (!conf || !dsp) {
 		printk(KERN_WARNING "%s: conf or dsp is 0.\n", __func__);
@@ -237,19 +313,47 @@ dsp_cmx_add_conf_member(struct dsp *dsp, struct dsp_conf *conf)
 		return -EINVAL;
 	}
 
-	member = kzalloc(sizeof(struct dsp_conf_member), GFP_ATOMIC);
+	/* grow members table, if full */
+	if (conf->count == conf->size) {
+		size = conf->size ? conf->size * 2 : 8;
+		members = krealloc(conf->members, size * sizeof(struct dsp *),
+				   GFP_ATOMIC);
+		if (!members) {
+			printk(KERN_ERR "krealloc conf members failed\n");
+			return -ENOMEM;
+		}
+		conf->members = members;
+		conf->size = size;
+	}
+
+	member = mISDN_cache_alloc(&dsp_member_cache, GFP_ATOMIC);
 	if (!member) {
-		printk(KERN_ERR "kzalloc struct dsp_conf_member failed\n");
+		printk(KERN_ERR "alloc struct dsp_conf_member failed\n");
 		return -ENOMEM;
 	}
+	/* rx buffer is only required while being member, take the one
+	 * allocated by the caller, if any */
+	if (!dsp->rx_buff) {
+		dsp->rx_buff = dsp->rx_spare;
+		dsp->rx_spare = NULL;
+	}
+	if (!dsp->rx_buff) {
+		dsp->rx_buff = dsp_cmx_ring_alloc(GFP_ATOMIC);
+		if (!dsp->rx_buff) {
+			printk(KERN_ERR "alloc rx buffer failed\n");
+			mISDN_cache_free(&dsp_member_cache, member);
+			return -ENOMEM;
+		}
+	}
 	member->dsp = dsp;
 	/* clear rx buffer */
-	memset(dsp->rx_buff, dsp_silence, sizeof(dsp->rx_buff));
+	memset(dsp->rx_buff, dsp_silence, CMX_BUFF_SIZE);
 	dsp->rx_init = 1; /* rx_W and rx_R will be adjusted on first frame */
 	dsp->rx_W = 0;
 	dsp->rx_R = 0;
 
 	list_add_tail(&member->list, &conf->mlist);
+	conf->members[conf->count++] = dsp;
 
 	dsp->conf = conf;
 	dsp->member = member;
@@ -265,6 +369,8 @@ int
 dsp_cmx_del_conf_member(struct dsp *dsp)
 {
 	struct dsp_conf_member *member;
+	struct dsp_conf *conf;
+	int i;
 
 	if (!dsp) {
 		printk(KERN_WARNING "%s: dsp is 0.\n",
@@ -288,9 +394,21 @@ dsp_cmx_del_conf_member(struct dsp *dsp)
 	list_for_each_entry(member, &dsp->conf->mlist, list) {
 		if (member->dsp == dsp) {
 			list_del(&member->list);
+			/* remove from members table, keep the order */
+			conf = dsp->conf;
+			for (i = 0; i < conf->count; i++) {
+				if (conf->members[i] != dsp)
+					continue;
+				conf->count--;
+				memmove(&conf->members[i], &conf->members[i + 1],
+					(conf->count - i) * sizeof(struct dsp *));
+				break;
+			}
 			dsp->conf = NULL;
 			dsp->member = NULL;
-			kfree(member);
+			mISDN_cache_free(&dsp_member_cache, member);
+			dsp_cmx_ring_free(dsp->rx_buff);
+			dsp->rx_buff = NULL;
 			return 0;
 		}
 	}
@@ -316,15 +434,18 @@ static struct dsp_conf
 		return NULL;
 	}
 
-	conf = kzalloc(sizeof(struct dsp_conf), GFP_ATOMIC);
+	conf = mISDN_cache_alloc(&dsp_conf_cache, GFP_ATOMIC);
 	if (!conf) {
-		printk(KERN_ERR "kzalloc struct dsp_conf failed\n");
+		printk(KERN_ERR "alloc struct dsp_conf failed\n");
 		return NULL;
 	}
-	INIT_LIST_HEAD(&conf->mlist);
 	conf->id = id;
+	conf->worker = dsp_cmx_assign_worker();
 
 	list_add_tail(&conf->list, &conf_ilist);
+	if (dsp_cmx_workers)
+		list_add_tail(&conf->cmx_list,
+			      &dsp_cmx_worker[conf->worker].confs);
 
 	return conf;
 }
@@ -348,7 +469,10 @@ dsp_cmx_del_conf(struct dsp_conf *conf)
 		return -EINVAL;
 	}
 	list_del(&conf->list);
-	kfree(conf);
+	if (dsp_cmx_workers)
+		list_del(&conf->cmx_list);
+	kfree(conf->members);
+	mISDN_cache_free(&dsp_conf_cache, conf);
 
 	return 0;
 }
@@ -1175,11 +1299,41 @@ showdelay(struct dsp *dsp, int samples, int delay)
 }
 #endif
 
+/*
+ * check if rx pointers must be adjusted before data can be written.
+ * the read pointer belongs to the cmx, so this requires dsp_lock to be
+ * held for writing.
+ */
+static int
+dsp_cmx_rx_resync(struct dsp *dsp, struct mISDNhead *hh)
+{
+	int w, r;
+
+	if (dsp->rx_init)
+		return 1;
+	w = dsp->rx_W;
+	if (dsp->features.unordered)
+		w = hh->id & CMX_BUFF_MASK;
+	r = smp_load_acquire(&dsp->rx_R);
+	/* underrun (or overrun the maximum delay) */
+	if (((w - r) & CMX_BUFF_MASK) >= CMX_BUFF_HALF)
+		return 1;
+	/* double delay */
+	if (dsp->cmx_delay &&
+	    ((w - r) & CMX_BUFF_MASK) >= (dsp->cmx_delay << 1))
+		return 1;
+	return 0;
+}
+
 /*
  * audio data is received from card
+ *
+ * this is the producer of rx_buff, it runs with dsp_lock held for reading.
+ * if the pointers must be adjusted, -EAGAIN is returned and the caller
+ * must call again with dsp_lock held for writing and resync set.
  */
-void
-dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb)
+int
+dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb, int resync)
 {
 	u8 *d, *p;
 	int len = skb->len;
@@ -1188,7 +1342,7 @@ dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb)
 
 	/* check if we have sompen */
 	if (len < 1)
-		return;
+		return 0;
 
 	/* half of the buffer should be larger than maximum packet size */
 	if (len >= CMX_BUFF_HALF) {
@@ -1196,9 +1350,12 @@ dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb)
 		       "%s line %d: packet from card is too large (%d bytes). "
 		       "please make card send smaller packets OR increase "
 		       "CMX_BUFF_SIZE\n", __FILE__, __LINE__, len);
-		return;
+		return 0;
 	}
 
+	if (!resync && dsp_cmx_rx_resync(dsp, hh))
+		return -EAGAIN;
+
 	/*
 	 * initialize pointers if not already -
 	 * also add delay if requested by PH_SIGNAL
@@ -1230,7 +1387,8 @@ dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb)
 	 * if we underrun (or maybe overrun),
 	 * we set our new read pointer, and write silence to buffer
 	 */
-	if (((dsp->rx_W-dsp->rx_R) & CMX_BUFF_MASK) >= CMX_BUFF_HALF) {
+	if (resync &&
+	    ((dsp->rx_W-dsp->rx_R) & CMX_BUFF_MASK) >= CMX_BUFF_HALF) {
 		if (dsp_debug & DEBUG_DSP_CLOCK)
 			printk(KERN_DEBUG
 			       "cmx_receive(dsp=%lx): UNDERRUN (or overrun the "
@@ -1252,10 +1410,10 @@ dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb)
 			else
 				dsp->rx_W = dsp_poll >> 1;
 		}
-		memset(dsp->rx_buff, dsp_silence, sizeof(dsp->rx_buff));
+		memset(dsp->rx_buff, dsp_silence, CMX_BUFF_SIZE);
 	}
 	/* if we have reached double delay, jump back to middle */
-	if (dsp->cmx_delay)
+	if (resync && dsp->cmx_delay)
 		if (((dsp->rx_W - dsp->rx_R) & CMX_BUFF_MASK) >=
 		    (dsp->cmx_delay << 1)) {
 			if (dsp_debug & DEBUG_DSP_CLOCK)
@@ -1273,7 +1431,7 @@ dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb)
 				dsp->rx_R = 0;
 				dsp->rx_W = dsp->cmx_delay;
 			}
-			memset(dsp->rx_buff, dsp_silence, sizeof(dsp->rx_buff));
+			memset(dsp->rx_buff, dsp_silence, CMX_BUFF_SIZE);
 		}
 
 	/* show where to write */
@@ -1294,11 +1452,12 @@ dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb)
 		i++;
 	}
 
-	/* increase write-pointer */
-	dsp->rx_W = ((dsp->rx_W + len) & CMX_BUFF_MASK);
+	/* increase write-pointer, publish data to the cmx */
+	smp_store_release(&dsp->rx_W, (dsp->rx_W + len) & CMX_BUFF_MASK);
 #ifdef CMX_DELAY_DEBUG
 	showdelay(dsp, len, (dsp->rx_W-dsp->rx_R) & CMX_BUFF_MASK);
 #endif
+	return 0;
 }
 
 
@@ -1306,14 +1465,18 @@ dsp_cmx_receive(struct dsp *dsp, struct sk_buff *skb)
  * send (mixed) audio data to card and control jitter
  */
 static void
-dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
+dsp_cmx_send_member(struct dsp *dsp, int len, struct dsp_mix_buffer *mix,
+		    int members)
 {
 	struct dsp_conf *conf = dsp->conf;
 	struct dsp *member, *other;
 	register s32 sample;
 	u8 *d, *p, *q, *o_q;
+	s16 *x;
+	const s16 *add;
 	struct sk_buff *nskb, *txskb;
 	int r, rr, t, tt, o_r, o_rr;
+	int i, n, off;
 	int preload = 0;
 	struct mISDNhead *hh, *thh;
 	int tx_data_only = 0;
@@ -1325,7 +1488,7 @@ dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
 	}
 	if (((dsp->conf && dsp->conf->hardware) || /* hardware conf */
 	     dsp->echo.hardware) && /* OR hardware echo */
-	    dsp->tx_R == dsp->tx_W && /* AND no tx-data */
+	    dsp->tx_R == READ_ONCE(dsp->tx_W) && /* AND no tx-data */
 	    !(dsp->tone.tone && dsp->tone.software)) { /* AND not soft tones */
 		if (!dsp->tx_data) { /* no tx_data for user space required */
 			dsp->last_tx = 0;
@@ -1369,7 +1532,7 @@ dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
 	q = dsp->rx_buff; /* received data */
 	d = skb_put(nskb, preload + len); /* result */
 	t = dsp->tx_R; /* tx-pointers */
-	tt = dsp->tx_W;
+	tt = smp_load_acquire(&dsp->tx_W);
 	r = dsp->rx_R; /* rx-pointers */
 	rr = (r + len) & CMX_BUFF_MASK;
 
@@ -1383,8 +1546,8 @@ dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
 	if (dsp->tone.tone && dsp->tone.software) {
 		/* -> copy tone */
 		dsp_tone_copy(dsp, d, len);
-		dsp->tx_R = 0; /* clear tx buffer */
-		dsp->tx_W = 0;
+		/* drop tx-data, the write pointer belongs to the producer */
+		smp_store_release(&dsp->tx_R, tt);
 		goto send_packet;
 	}
 	/* if we have tx-data but do not use mixing */
@@ -1404,7 +1567,7 @@ dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
 			r = (r + 1) & CMX_BUFF_MASK;
 		}
 		if (r == rr) {
-			dsp->tx_R = t;
+			smp_store_release(&dsp->tx_R, t);
 #ifdef CMX_TX_DEBUG
 			printk(KERN_DEBUG "%s\n", debugbuf);
 #endif
@@ -1417,8 +1580,8 @@ dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
 
 	/* PROCESS DATA (one member / no conf) */
 	if (!conf || members <= 1) {
-		/* -> if echo is NOT enabled */
-		if (!dsp->echo.software) {
+		/* -> if echo is NOT enabled (or there is no rx-data) */
+		if (!dsp->echo.software || !q) {
 			/* -> send tx-data if available or use 0-volume */
 			while (r != rr && t != tt) {
 				*d++ = p[t]; /* write tx_buff */
@@ -1447,7 +1610,7 @@ dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
 				r = (r + 1) & CMX_BUFF_MASK;
 			}
 		}
-		dsp->tx_R = t;
+		smp_store_release(&dsp->tx_R, t);
 		goto send_packet;
 	}
 	/* PROCESS DATA (two members) */
@@ -1457,11 +1620,9 @@ dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
 	if (members == 2) {
 #endif
 		/* "other" becomes other party */
-		other = (list_entry(conf->mlist.next,
-				    struct dsp_conf_member, list))->dsp;
+		other = conf->members[0];
 		if (other == member)
-			other = (list_entry(conf->mlist.prev,
-				    struct dsp_conf_member, list))->dsp;
+			other = conf->members[1];
 		o_q = other->rx_buff; /* received data */
 		o_rr = (other->rx_R + len) & CMX_BUFF_MASK;
 		/* end of rx-pointer */
@@ -1508,67 +1669,34 @@ dsp_cmx_send_member(struct dsp *dsp, int len, s32 *c, int members)
 				o_r = (o_r + 1) & CMX_BUFF_MASK;
 			}
 		}
-		dsp->tx_R = t;
+		smp_store_release(&dsp->tx_R, t);
 		goto send_packet;
 	}
 	/* PROCESS DATA (three or more members) */
-	/* -> if echo is NOT enabled */
-	if (!dsp->echo.software) {
-		/*
-		 * -> subtract rx-data from conf-data,
-		 * if tx-data is available, mix
-		 */
-		while (r != rr && t != tt) {
-			sample = dsp_audio_law_to_s32[p[t]] + *c++ -
-				dsp_audio_law_to_s32[q[r]];
-			if (sample < -32768)
-				sample = -32768;
-			else if (sample > 32767)
-				sample = 32767;
-			*d++ = dsp_audio_s16_to_law[sample & 0xffff];
-			/* conf-rx+tx */
-			r = (r + 1) & CMX_BUFF_MASK;
-			t = (t + 1) & CMX_BUFF_MASK;
-		}
-		while (r != rr) {
-			sample = *c++ - dsp_audio_law_to_s32[q[r]];
-			if (sample < -32768)
-				sample = -32768;
-			else if (sample > 32767)
-				sample = 32767;
-			*d++ = dsp_audio_s16_to_law[sample & 0xffff];
-			/* conf-rx */
-			r = (r + 1) & CMX_BUFF_MASK;
-		}
-		/* -> if echo is enabled */
-	} else {
-		/*
-		 * -> encode conf-data, if tx-data
-		 * is available, mix
-		 */
-		while (r != rr && t != tt) {
-			sample = dsp_audio_law_to_s32[p[t]] + *c++;
-			if (sample < -32768)
-				sample = -32768;
-			else if (sample > 32767)
-				sample = 32767;
-			*d++ = dsp_audio_s16_to_law[sample & 0xffff];
-			/* conf(echo)+tx */
-			t = (t + 1) & CMX_BUFF_MASK;
-			r = (r + 1) & CMX_BUFF_MASK;
-		}
-		while (r != rr) {
-			sample = *c++;
-			if (sample < -32768)
-				sample = -32768;
-			else if (sample > 32767)
-				sample = 32767;
-			*d++ = dsp_audio_s16_to_law[sample & 0xffff];
-			/* conf(echo) */
-			r = (r + 1) & CMX_BUFF_MASK;
-		}
+	/* remaining samples, tx-data may have been sent already */
+	n = (rr - r) & CMX_BUFF_MASK;
+	off = len - n;
+	/* -> decode tx-data, if available, to mix it */
+	add = dsp_mix_silence;
+	if (t != tt) {
+		x = mix->tx;
+		i = (tt - t) & CMX_BUFF_MASK;
+		if (i > n)
+			i = n;
+		dsp_mix_decode(x, p, t, i);
+		t = (t + i) & CMX_BUFF_MASK;
+		if (i < n)
+			memset(x + i, 0, (n - i) * sizeof(s16));
+		add = x;
 	}
-	dsp->tx_R = t;
+	/*
+	 * -> subtract rx-data from conf-data, if echo is NOT enabled,
+	 * and encode the result
+	 */
+	dsp_mix_member(mix->out, mix->sum + off, dsp->echo.software ?
+		       dsp_mix_silence : dsp->rx_lin + off, add, n);
+	dsp_audio_encode(d, mix->out, n);
+	smp_store_release(&dsp->tx_R, t);
 	goto send_packet;
 
 send_packet:
@@ -1621,26 +1749,421 @@ send_packet:
 static u32	jittercount; /* counter for jitter check */
 struct timer_list dsp_spl_tl;
 unsigned long	dsp_spl_jiffies; /* calculate the next time to fire */
+struct hrtimer	dsp_spl_hrtimer; /* used instead of dsp_spl_tl, if enabled */
+ktime_t		dsp_spl_period; /* period of dsp_spl_hrtimer */
+static void	dsp_cmx_hrtick(unsigned long arg);
+DECLARE_TASKLET(dsp_spl_tasklet, dsp_cmx_hrtick, 0);
 static u16	dsp_count; /* last sample count */
 static int	dsp_count_valid; /* if we have last sample count */
 
-void
-dsp_cmx_send(void *arg)
+int		dsp_cmx_workers; /* number of cmx workers, 0 = mix in timer */
+struct dsp_cmx_worker *dsp_cmx_worker;
+static struct workqueue_struct *dsp_cmx_wq;
+static int	dsp_cmx_next_worker; /* worker for the next conf/dsp */
+
+/*
+ * send data of a dsp instance that does not require conference mixing
+ */
+static void
+dsp_cmx_mix_dsp(struct dsp *dsp, struct dsp_mix_buffer *mix, u16 length)
 {
 	struct dsp_conf *conf;
-	struct dsp_conf_member *member;
-	struct dsp *dsp;
 	int mustmix, members;
-	static s32 mixbuffer[MAX_POLL + 100];
-	s32 *c;
+
+	if (dsp->hdlc)
+		return;
+	conf = dsp->conf;
+	mustmix = 0;
+	members = 0;
+	if (conf) {
+		members = conf->count;
+#ifdef CMX_CONF_DEBUG
+		if (conf->software && members > 1)
+#else
+		if (conf->software && members > 2)
+#endif
+			mustmix = 1;
+	}
+
+	/* transmission required */
+	if (!mustmix) {
+		dsp_cmx_send_member(dsp, length, mix, members);
+
+		/*
+		 * unused mix buffer is given to prevent a
+		 * potential null-pointer-bug
+		 */
+	}
+}
+
+/*
+ * mix and send data of a conference that requires mixing
+ */
+static void
+dsp_cmx_mix_conf(struct dsp_conf *conf, struct dsp_mix_buffer *mix,
+		 u16 length)
+{
+	struct dsp *dsp;
+	int members, i;
+
+	/* count members and check hardware */
+	members = conf->count;
+#ifdef CMX_CONF_DEBUG
+	if (conf->software && members > 1) {
+#else
+	if (conf->software && members > 2) {
+#endif
+		/* check for hdlc conf */
+		if (conf->members[0]->hdlc)
+			return;
+		/* mix all data */
+		memset(mix->sum, 0, length * sizeof(s32));
+		for (i = 0; i < members; i++) {
+			dsp = conf->members[i];
+			/* decode member's data once and add it */
+			dsp_mix_decode(dsp->rx_lin, dsp->rx_buff,
+				       dsp->rx_R, length);
+			dsp_mix_sum(mix->sum, dsp->rx_lin, length);
+		}
+
+		/* process each member */
+		for (i = 0; i < members; i++) {
+			/* transmission */
+			dsp_cmx_send_member(conf->members[i], length,
+					    mix, members);
+		}
+	}
+}
+
+/*
+ * delete rx-data, increment buffers, change pointers of a dsp instance
+ */
+static void
+dsp_cmx_mix_buffers(struct dsp *dsp, u16 length, int jittercheck)
+{
 	u8 *p, *q;
-	int r, rr;
-	int jittercheck = 0, delay, i;
+	int r, rr, w, ww;
+	int delay, i;
+
+	if (dsp->hdlc)
+		return;
+	p = dsp->rx_buff;
+	q = dsp->tx_buff;
+	r = dsp->rx_R;
+	w = smp_load_acquire(&dsp->rx_W);
+	/* move receive pointer when receiving */
+	if (!dsp->rx_is_off) {
+		rr = (r + length) & CMX_BUFF_MASK;
+		/*
+		 * delete rx-data, but do not touch what the card
+		 * has not written yet
+		 */
+		delay = (w - r) & CMX_BUFF_MASK;
+		if (delay >= CMX_BUFF_HALF)
+			ww = r;
+		else if (delay < length)
+			ww = w;
+		else
+			ww = rr;
+		while (p && r != ww) {
+			p[r] = dsp_silence;
+			r = (r + 1) & CMX_BUFF_MASK;
+		}
+		/* increment rx-buffer pointer */
+		smp_store_release(&dsp->rx_R, rr);
+	}
+
+	/* check current rx_delay */
+	delay = (w - dsp->rx_R) & CMX_BUFF_MASK;
+	if (delay >= CMX_BUFF_HALF)
+		delay = 0; /* will be the delay before next write */
+	/* check for lower delay */
+	if (delay < dsp->rx_delay[0])
+		dsp->rx_delay[0] = delay;
+	/* check current tx_delay */
+	delay = (READ_ONCE(dsp->tx_W) - dsp->tx_R) & CMX_BUFF_MASK;
+	if (delay >= CMX_BUFF_HALF)
+		delay = 0; /* will be the delay before next write */
+	/* check for lower delay */
+	if (delay < dsp->tx_delay[0])
+		dsp->tx_delay[0] = delay;
+	if (jittercheck) {
+		/* find the lowest of all rx_delays */
+		delay = dsp->rx_delay[0];
+		i = 1;
+		while (i < MAX_SECONDS_JITTER_CHECK) {
+			if (delay > dsp->rx_delay[i])
+				delay = dsp->rx_delay[i];
+			i++;
+		}
+		/*
+		 * remove rx_delay only if we have delay AND we
+		 * have not preset cmx_delay AND
+		 * the delay is greater dsp_poll
+		 */
+		if (delay > dsp_poll && !dsp->cmx_delay) {
+			if (dsp_debug & DEBUG_DSP_CLOCK)
+				printk(KERN_DEBUG
+				       "%s lowest rx_delay of %d bytes for"
+				       " dsp %s are now removed.\n",
+				       __func__, delay,
+				       dsp->name);
+			r = dsp->rx_R;
+			rr = (r + delay - (dsp_poll >> 1))
+				& CMX_BUFF_MASK;
+			/* delete rx-data */
+			while (p && r != rr) {
+				p[r] = dsp_silence;
+				r = (r + 1) & CMX_BUFF_MASK;
+			}
+			/* increment rx-buffer pointer */
+			smp_store_release(&dsp->rx_R, r);
+			/* write incremented read pointer */
+		}
+		/* find the lowest of all tx_delays */
+		delay = dsp->tx_delay[0];
+		i = 1;
+		while (i < MAX_SECONDS_JITTER_CHECK) {
+			if (delay > dsp->tx_delay[i])
+				delay = dsp->tx_delay[i];
+			i++;
+		}
+		/*
+		 * remove delay only if we have delay AND we
+		 * have enabled tx_dejitter
+		 */
+		if (delay > dsp_poll && dsp->tx_dejitter) {
+			if (dsp_debug & DEBUG_DSP_CLOCK)
+				printk(KERN_DEBUG
+				       "%s lowest tx_delay of %d bytes for"
+				       " dsp %s are now removed.\n",
+				       __func__, delay,
+				       dsp->name);
+			r = dsp->tx_R;
+			rr = (r + delay - (dsp_poll >> 1))
+				& CMX_BUFF_MASK;
+			/* delete tx-data */
+			while (r != rr) {
+				q[r] = dsp_silence;
+				r = (r + 1) & CMX_BUFF_MASK;
+			}
+			/* increment rx-buffer pointer */
+			smp_store_release(&dsp->tx_R, r);
+			/* write incremented read pointer */
+		}
+		/* scroll up delays */
+		i = MAX_SECONDS_JITTER_CHECK - 1;
+		while (i) {
+			dsp->rx_delay[i] = dsp->rx_delay[i - 1];
+			dsp->tx_delay[i] = dsp->tx_delay[i - 1];
+			i--;
+		}
+		dsp->tx_delay[0] = CMX_BUFF_HALF; /* (infinite) delay */
+		dsp->rx_delay[0] = CMX_BUFF_HALF; /* (infinite) delay */
+	}
+}
+
+/*
+ * mix and send data of all dsp instances and conferences that belong to the
+ * given worker, or of all of them, if no worker is given.
+ * a worker only walks its own lists, the dsp instances that are member of
+ * a conference belong to the worker of the conference.
+ */
+static void
+dsp_cmx_mix(struct dsp_cmx_worker *worker, struct dsp_mix_buffer *mix,
+	    u16 length, int jittercheck)
+{
+	struct dsp_conf_member *member;
+	struct dsp_conf *conf;
+	struct dsp *dsp;
+
+	if (!worker) {
+		/* loop all members that do not require conference mixing */
+		list_for_each_entry(dsp, &dsp_ilist, list)
+			dsp_cmx_mix_dsp(dsp, mix, length);
+		/* loop all members that require conference mixing */
+		list_for_each_entry(conf, &conf_ilist, list)
+			dsp_cmx_mix_conf(conf, mix, length);
+		/* delete rx-data, increment buffers, change pointers */
+		list_for_each_entry(dsp, &dsp_ilist, list)
+			dsp_cmx_mix_buffers(dsp, length, jittercheck);
+		return;
+	}
+
+	list_for_each_entry(dsp, &worker->dsps, cmx_list)
+		if (!dsp->conf)
+			dsp_cmx_mix_dsp(dsp, mix, length);
+	list_for_each_entry(conf, &worker->confs, cmx_list)
+		list_for_each_entry(member, &conf->mlist, list)
+			dsp_cmx_mix_dsp(member->dsp, mix, length);
+	list_for_each_entry(conf, &worker->confs, cmx_list)
+		dsp_cmx_mix_conf(conf, mix, length);
+	list_for_each_entry(dsp, &worker->dsps, cmx_list)
+		if (!dsp->conf)
+			dsp_cmx_mix_buffers(dsp, length, jittercheck);
+	list_for_each_entry(conf, &worker->confs, cmx_list)
+		list_for_each_entry(member, &conf->mlist, list)
+			dsp_cmx_mix_buffers(member->dsp, length, jittercheck);
+}
+
+/*
+ * cmx worker: mixes its share of conferences and dsp instances.
+ * dsp_lock is only held for reading, so the workers run in parallel.
+ */
+static void
+dsp_cmx_work(struct work_struct *work)
+{
+	struct dsp_cmx_worker *worker =
+		container_of(work, struct dsp_cmx_worker, w.work);
+	int length, jittercheck;
 	u_long flags;
-	u16 length, count;
 
-	/* lock */
-	spin_lock_irqsave(&dsp_lock, flags);
+	read_lock_irqsave(&dsp_lock, flags);
+	spin_lock(&worker->lock);
+	length = atomic_xchg(&worker->length, 0);
+	jittercheck = test_and_clear_bit(0, &worker->jittercheck);
+	if (length > MAX_POLL + 100)
+		length = MAX_POLL + 100;
+	if (length > 0)
+		dsp_cmx_mix(worker, &worker->mix, length, jittercheck);
+	spin_unlock(&worker->lock);
+	read_unlock_irqrestore(&dsp_lock, flags);
+}
+
+/*
+ * the worker a new conference or a dsp instance without conference is
+ * mixed by, must be called with dsp_lock held for writing
+ */
+int
+dsp_cmx_assign_worker(void)
+{
+	int nr;
+
+	if (!dsp_cmx_workers)
+		return 0;
+	nr = dsp_cmx_next_worker;
+	if (++dsp_cmx_next_worker >= dsp_cmx_workers)
+		dsp_cmx_next_worker = 0;
+	return nr;
+}
+
+/*
+ * add a new dsp instance to the list of its worker, or remove it,
+ * must be called with dsp_lock held for writing
+ */
+void
+dsp_cmx_add_worker_dsp(struct dsp *dsp)
+{
+	if (dsp_cmx_workers)
+		list_add_tail(&dsp->cmx_list,
+			      &dsp_cmx_worker[dsp->cmx_worker].dsps);
+}
+
+void
+dsp_cmx_del_worker_dsp(struct dsp *dsp)
+{
+	if (dsp_cmx_workers)
+		list_del(&dsp->cmx_list);
+}
+
+/*
+ * allocate the workers of the cmx or the ec, not more than there are online
+ * cpus, and spread them over the online cpus
+ */
+void *
+dsp_workers_alloc(int *count, int max, size_t size, work_func_t func)
+{
+	struct dsp_worker *w;
+	void *workers;
+	int i, cpu;
+
+	if (*count > num_online_cpus())
+		*count = num_online_cpus();
+	if (*count > max)
+		*count = max;
+
+	workers = kcalloc(*count, size, GFP_KERNEL);
+	if (!workers)
+		return NULL;
+	cpu = cpumask_first(cpu_online_mask);
+	for (i = 0; i < *count; i++) {
+		w = workers + i * size;
+		INIT_WORK(&w->work, func);
+		w->nr = i;
+		w->cpu = cpu;
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+	}
+	return workers;
+}
+
+/* queue a worker on its cpu, or on any cpu if its cpu went offline */
+void
+dsp_worker_queue(struct workqueue_struct *wq, struct dsp_worker *w)
+{
+	if (cpu_online(w->cpu))
+		queue_work_on(w->cpu, wq, &w->work);
+	else
+		queue_work(wq, &w->work);
+}
+
+int
+dsp_cmx_init_workers(int count)
+{
+	struct dsp_cmx_worker *worker;
+	int i;
+
+	if (count <= 0)
+		return 0;
+	dsp_cmx_worker = dsp_workers_alloc(&count, MAX_CMX_WORKERS,
+					   sizeof(struct dsp_cmx_worker),
+					   dsp_cmx_work);
+	if (!dsp_cmx_worker) {
+		printk(KERN_ERR "kcalloc struct dsp_cmx_worker failed\n");
+		return -ENOMEM;
+	}
+	dsp_cmx_wq = alloc_workqueue("mISDN_cmx", WQ_HIGHPRI, 0);
+	if (!dsp_cmx_wq) {
+		printk(KERN_ERR "%s: cannot create workqueue\n", __func__);
+		kfree(dsp_cmx_worker);
+		dsp_cmx_worker = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < count; i++) {
+		worker = &dsp_cmx_worker[i];
+		spin_lock_init(&worker->lock);
+		atomic_set(&worker->length, 0);
+		INIT_LIST_HEAD(&worker->dsps);
+		INIT_LIST_HEAD(&worker->confs);
+	}
+	dsp_cmx_workers = count;
+	return 0;
+}
+
+void
+dsp_cmx_cleanup_workers(void)
+{
+	if (!dsp_cmx_workers)
+		return;
+	/* timer must be stopped already, so no new work is queued */
+	destroy_workqueue(dsp_cmx_wq);
+	dsp_cmx_workers = 0;
+	kfree(dsp_cmx_worker);
+	dsp_cmx_worker = NULL;
+}
+
+/*
+ * one tick of the cmx clock: mix and send the samples counted by
+ * mISDN_clock_get() since the last tick
+ */
+static void
+dsp_cmx_tick(void)
+{
+	static struct dsp_mix_buffer mix;
+	struct dsp_cmx_worker *worker;
+	int jittercheck = 0, i;
+	u16 length, count;
 
 	if (!dsp_count_valid) {
 		dsp_count = mISDN_clock_get();
@@ -1664,194 +2187,81 @@ dsp_cmx_send(void *arg)
 		jittercheck = 1;
 	}
 
-	/* loop all members that do not require conference mixing */
-	list_for_each_entry(dsp, &dsp_ilist, list) {
-		if (dsp->hdlc)
-			continue;
-		conf = dsp->conf;
-		mustmix = 0;
-		members = 0;
-		if (conf) {
-			members = count_list_member(&conf->mlist);
-#ifdef CMX_CONF_DEBUG
-			if (conf->software && members > 1)
-#else
-				if (conf->software && members > 2)
-#endif
-					mustmix = 1;
+	if (!dsp_cmx_workers) {
+		dsp_cmx_mix(NULL, &mix, length, jittercheck);
+	} else {
+		/* hand out the samples to process to all workers */
+		for (i = 0; i < dsp_cmx_workers; i++) {
+			worker = &dsp_cmx_worker[i];
+			atomic_add(length, &worker->length);
+			if (jittercheck)
+				set_bit(0, &worker->jittercheck);
+			dsp_worker_queue(dsp_cmx_wq, &worker->w);
 		}
+	}
+}
 
-		/* transmission required */
-		if (!mustmix) {
-			dsp_cmx_send_member(dsp, length, mixbuffer, members);
+void
+dsp_cmx_send(void *arg)
+{
+	u_long flags = 0;
 
-			/*
-			 * unused mixbuffer is given to prevent a
-			 * potential null-pointer-bug
-			 */
-		}
-	}
+	/*
+	 * lock, the cmx workers take their own locks.
+	 * the rings are lock free, so reading is enough to exclude changes
+	 * of settings and conferences.
+	 */
+	if (!dsp_cmx_workers)
+		read_lock_irqsave(&dsp_lock, flags);
 
-	/* loop all members that require conference mixing */
-	list_for_each_entry(conf, &conf_ilist, list) {
-		/* count members and check hardware */
-		members = count_list_member(&conf->mlist);
-#ifdef CMX_CONF_DEBUG
-		if (conf->software && members > 1) {
-#else
-			if (conf->software && members > 2) {
-#endif
-				/* check for hdlc conf */
-				member = list_entry(conf->mlist.next,
-						    struct dsp_conf_member, list);
-				if (member->dsp->hdlc)
-					continue;
-				/* mix all data */
-				memset(mixbuffer, 0, length * sizeof(s32));
-				list_for_each_entry(member, &conf->mlist, list) {
-					dsp = member->dsp;
-					/* get range of data to mix */
-					c = mixbuffer;
-					q = dsp->rx_buff;
-					r = dsp->rx_R;
-					rr = (r + length) & CMX_BUFF_MASK;
-					/* add member's data */
-					while (r != rr) {
-						*c++ += dsp_audio_law_to_s32[q[r]];
-						r = (r + 1) & CMX_BUFF_MASK;
-					}
-				}
+	dsp_cmx_tick();
 
-				/* process each member */
-				list_for_each_entry(member, &conf->mlist, list) {
-					/* transmission */
-					dsp_cmx_send_member(member->dsp, length,
-							    mixbuffer, members);
-				}
-			}
-		}
+	/* if next event would be in the past ... */
+	if ((s32)(dsp_spl_jiffies + dsp_tics-jiffies) <= 0)
+		dsp_spl_jiffies = jiffies + 1;
+	else
+		dsp_spl_jiffies += dsp_tics;
 
-		/* delete rx-data, increment buffers, change pointers */
-		list_for_each_entry(dsp, &dsp_ilist, list) {
-			if (dsp->hdlc)
-				continue;
-			p = dsp->rx_buff;
-			q = dsp->tx_buff;
-			r = dsp->rx_R;
-			/* move receive pointer when receiving */
-			if (!dsp->rx_is_off) {
-				rr = (r + length) & CMX_BUFF_MASK;
-				/* delete rx-data */
-				while (r != rr) {
-					p[r] = dsp_silence;
-					r = (r + 1) & CMX_BUFF_MASK;
-				}
-				/* increment rx-buffer pointer */
-				dsp->rx_R = r; /* write incremented read pointer */
-			}
+	dsp_spl_tl.expires = dsp_spl_jiffies;
+	add_timer(&dsp_spl_tl);
 
-			/* check current rx_delay */
-			delay = (dsp->rx_W-dsp->rx_R) & CMX_BUFF_MASK;
-			if (delay >= CMX_BUFF_HALF)
-				delay = 0; /* will be the delay before next write */
-			/* check for lower delay */
-			if (delay < dsp->rx_delay[0])
-				dsp->rx_delay[0] = delay;
-			/* check current tx_delay */
-			delay = (dsp->tx_W-dsp->tx_R) & CMX_BUFF_MASK;
-			if (delay >= CMX_BUFF_HALF)
-				delay = 0; /* will be the delay before next write */
-			/* check for lower delay */
-			if (delay < dsp->tx_delay[0])
-				dsp->tx_delay[0] = delay;
-			if (jittercheck) {
-				/* find the lowest of all rx_delays */
-				delay = dsp->rx_delay[0];
-				i = 1;
-				while (i < MAX_SECONDS_JITTER_CHECK) {
-					if (delay > dsp->rx_delay[i])
-						delay = dsp->rx_delay[i];
-					i++;
-				}
-				/*
-				 * remove rx_delay only if we have delay AND we
-				 * have not preset cmx_delay AND
-				 * the delay is greater dsp_poll
-				 */
-				if (delay > dsp_poll && !dsp->cmx_delay) {
-					if (dsp_debug & DEBUG_DSP_CLOCK)
-						printk(KERN_DEBUG
-						       "%s lowest rx_delay of %d bytes for"
-						       " dsp %s are now removed.\n",
-						       __func__, delay,
-						       dsp->name);
-					r = dsp->rx_R;
-					rr = (r + delay - (dsp_poll >> 1))
-						& CMX_BUFF_MASK;
-					/* delete rx-data */
-					while (r != rr) {
-						p[r] = dsp_silence;
-						r = (r + 1) & CMX_BUFF_MASK;
-					}
-					/* increment rx-buffer pointer */
-					dsp->rx_R = r;
-					/* write incremented read pointer */
-				}
-				/* find the lowest of all tx_delays */
-				delay = dsp->tx_delay[0];
-				i = 1;
-				while (i < MAX_SECONDS_JITTER_CHECK) {
-					if (delay > dsp->tx_delay[i])
-						delay = dsp->tx_delay[i];
-					i++;
-				}
-				/*
-				 * remove delay only if we have delay AND we
-				 * have enabled tx_dejitter
-				 */
-				if (delay > dsp_poll && dsp->tx_dejitter) {
-					if (dsp_debug & DEBUG_DSP_CLOCK)
-						printk(KERN_DEBUG
-						       "%s lowest tx_delay of %d bytes for"
-						       " dsp %s are now removed.\n",
-						       __func__, delay,
-						       dsp->name);
-					r = dsp->tx_R;
-					rr = (r + delay - (dsp_poll >> 1))
-						& CMX_BUFF_MASK;
-					/* delete tx-data */
-					while (r != rr) {
-						q[r] = dsp_silence;
-						r = (r + 1) & CMX_BUFF_MASK;
-					}
-					/* increment rx-buffer pointer */
-					dsp->tx_R = r;
-					/* write incremented read pointer */
-				}
-				/* scroll up delays */
-				i = MAX_SECONDS_JITTER_CHECK - 1;
-				while (i) {
-					dsp->rx_delay[i] = dsp->rx_delay[i - 1];
-					dsp->tx_delay[i] = dsp->tx_delay[i - 1];
-					i--;
-				}
-				dsp->tx_delay[0] = CMX_BUFF_HALF; /* (infinite) delay */
-				dsp->rx_delay[0] = CMX_BUFF_HALF; /* (infinite) delay */
-			}
-		}
+	/* unlock */
+	if (!dsp_cmx_workers)
+		read_unlock_irqrestore(&dsp_lock, flags);
+}
 
-		/* if next event would be in the past ... */
-		if ((s32)(dsp_spl_jiffies + dsp_tics-jiffies) <= 0)
-			dsp_spl_jiffies = jiffies + 1;
-		else
-			dsp_spl_jiffies += dsp_tics;
+/*
+ * without cmx workers, the high resolution clock does the mixing in this
+ * tasklet, so it is not done in hard irq context.
+ */
+static void
+dsp_cmx_hrtick(unsigned long arg)
+{
+	u_long flags;
 
-		dsp_spl_tl.expires = dsp_spl_jiffies;
-		add_timer(&dsp_spl_tl);
+	read_lock_irqsave(&dsp_lock, flags);
+	dsp_cmx_tick();
+	read_unlock_irqrestore(&dsp_lock, flags);
+}
 
-		/* unlock */
-		spin_unlock_irqrestore(&dsp_lock, flags);
-	}
+/*
+ * high resolution cmx clock, the period is not bound to jiffies.
+ * if we are late, missed periods are skipped. this is no problem, because
+ * the number of samples is taken from mISDN_clock_get().
+ * the timer runs in hard irq context, it only hands out the samples to the
+ * cmx workers or schedules the tasklet.
+ */
+enum hrtimer_restart
+dsp_cmx_hrsend(struct hrtimer *timer)
+{
+	if (dsp_cmx_workers)
+		dsp_cmx_tick();
+	else
+		tasklet_schedule(&dsp_spl_tasklet);
+
+	hrtimer_forward_now(timer, dsp_spl_period);
+	return HRTIMER_RESTART;
+}
 
 /*
  * audio data is transmitted from upper layer to the dsp
@@ -1868,7 +2278,7 @@ dsp_cmx_send(void *arg)
 
 		/* check if there is enough space, and then copy */
 		w = dsp->tx_W;
-		ww = dsp->tx_R;
+		ww = smp_load_acquire(&dsp->tx_R);
 		p = dsp->tx_buff;
 		d = skb->data;
 		space = (ww - w - 1) & CMX_BUFF_MASK;
@@ -1883,7 +2293,6 @@ dsp_cmx_send(void *arg)
 		} else
 			/* write until all byte are copied */
 			ww = (w + skb->len) & CMX_BUFF_MASK;
-		dsp->tx_W = ww;
 
 		/* show current buffer */
 #ifdef CMX_DEBUG
@@ -1907,6 +2316,8 @@ dsp_cmx_send(void *arg)
 #ifdef CMX_TX_DEBUG
 		printk(KERN_DEBUG "%s\n", debugbuf);
 #endif
+		/* publish data to the cmx */
+		smp_store_release(&dsp->tx_W, ww);
 
 	}
 
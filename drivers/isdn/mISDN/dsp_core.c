@@ -133,12 +133,31 @@
  * will be played without cpu load. Small PBXs and NT-Mode applications will
  * not need expensive hardware when processing calls.
  *
+ * CLOCK: The CMX is clocked every 'poll' samples by a kernel timer, so poll
+ * must be a multiple of HZ. If module parameter hrclock is set, a high
+ * resolution timer is used instead. Then any poll value of 8-256 samples
+ * can be used, default is 8 samples (1 ms). The high resolution timer only
+ * hands out the samples to the cmx workers, or schedules a tasklet that does
+ * the mixing, so nothing is mixed in hard irq context. In both cases the
+ * number of samples to process is taken from the mISDN clock.
+ *
  *
  * LOCKING:
  *
  * When data is received from upper or lower layer (card), the complete dsp
  * module is locked by a global lock.  This lock MUST lock irq, because it
  * must lock timer events by DSP poll timer.
+ * The rx and tx buffers are lock free rings with one producer and one
+ * consumer (the CMX), so the global lock is only held for reading while
+ * data is processed or mixed. Only if the rx pointers must be adjusted, the
+ * lock is taken for writing. Changing settings or conferences requires the
+ * global lock for writing.
+ * If cmx workers are enabled (module parameter cmxworkers), different
+ * conferences are mixed on different cpus.
+ * If ec workers are enabled (module parameter ecworkers), the received data
+ * of instances with a pipeline is queued at the worker of the instance. The
+ * worker runs the pipelines of all its queued data in one fpu section and
+ * then finishes the receive path of each frame in order of arrival.
  * When data is ready to be transmitted down, the data is queued and sent
  * outside lock and timer event.
  * PH_CONTROL must not change any settings, join or split conference members
@@ -158,7 +177,7 @@
 #include <linux/mISDNif.h>
 #include <linux/mISDNdsp.h>
 #include <linux/module.h>
-#include <linux/vmalloc.h>
+#include <linux/slab.h>
 #include "core.h"
 #include "dsp.h"
 
@@ -168,22 +187,29 @@ static int debug;
 static int options;
 static int poll;
 static int dtmfthreshold = 100;
+static int cmxworkers;
+static int ecworkers;
+static int hrclock;
 
 MODULE_AUTHOR("Andreas Eversberg");
 module_param(debug, uint, S_IRUGO | S_IWUSR);
 module_param(options, uint, S_IRUGO | S_IWUSR);
 module_param(poll, uint, S_IRUGO | S_IWUSR);
 module_param(dtmfthreshold, uint, S_IRUGO | S_IWUSR);
+module_param(cmxworkers, uint, S_IRUGO);
+module_param(ecworkers, uint, S_IRUGO);
+module_param(hrclock, uint, S_IRUGO);
 MODULE_LICENSE("GPL");
 
 /*int spinnest = 0;*/
 
-spinlock_t dsp_lock; /* global dsp lock */
+rwlock_t dsp_lock; /* global dsp lock */
 struct list_head dsp_ilist;
 struct list_head conf_ilist;
 int dsp_debug;
 int dsp_options;
 int dsp_poll, dsp_tics;
+static struct mISDN_cache dsp_cache; /* struct dsp */
 
 /* check if rx may be turned off or must be turned on */
 static void
@@ -662,6 +688,78 @@ get_features(struct mISDNchannel *ch)
 			       __func__, dsp->name);
 }
 
+/*
+ * finish processing of received transparent data, after it is decrypted and
+ * passed the pipeline. returns 0, if the skb was consumed.
+ */
+int
+dsp_rx_finish(struct dsp *dsp, struct sk_buff *skb)
+{
+	struct mISDNhead	*hh = mISDN_HEAD_P(skb);
+	int			resync;
+	u8			*digits = NULL;
+	u_long			flags;
+
+	read_lock_irqsave(&dsp_lock, flags);
+
+	/* change volume if requested */
+	if (dsp->rx_volume)
+		dsp_change_volume(skb, dsp->rx_volume);
+	/* check if dtmf soft decoding is turned on */
+	if (dsp->dtmf.software) {
+		digits = dsp_dtmf_goertzel_decode(dsp, skb->data,
+						  skb->len, (dsp_options & DSP_OPT_ULAW) ? 1 : 0);
+	}
+	/* we need to process receive data if software */
+	resync = 0;
+	if (dsp->conf && dsp->conf->software) {
+		/* process data from card at cmx */
+		resync = dsp_cmx_receive(dsp, skb, 0) == -EAGAIN;
+	}
+
+	read_unlock_irqrestore(&dsp_lock, flags);
+
+	/* rx pointers must be adjusted, this must exclude the cmx */
+	if (resync) {
+		write_lock_irqsave(&dsp_lock, flags);
+		if (dsp->conf && dsp->conf->software)
+			dsp_cmx_receive(dsp, skb, 1);
+		write_unlock_irqrestore(&dsp_lock, flags);
+	}
+
+	/* send dtmf result, if any */
+	if (digits) {
+		while (*digits) {
+			int k;
+			struct sk_buff *nskb;
+			if (dsp_debug & DEBUG_DSP_DTMF)
+				printk(KERN_DEBUG "%s: digit"
+				       "(%c) to layer %s\n",
+				       __func__, *digits, dsp->name);
+			k = *digits | DTMF_TONE_VAL;
+			nskb = _alloc_mISDN_skb(PH_CONTROL_IND,
+						MISDN_ID_ANY, sizeof(int), &k,
+						GFP_ATOMIC);
+			if (nskb) {
+				if (dsp->up) {
+					if (dsp->up->send(
+						    dsp->up, nskb))
+						dev_kfree_skb(nskb);
+				} else
+					dev_kfree_skb(nskb);
+			}
+			digits++;
+		}
+	}
+	if (dsp->rx_disabled || !dsp->up) {
+		/* if receive is not allowed */
+		dev_kfree_skb(skb);
+		return 0;
+	}
+	hh->prim = DL_DATA_IND;
+	return dsp->up->send(dsp->up, skb);
+}
+
 static int
 dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 {
@@ -669,6 +767,7 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 	struct mISDNhead	*hh;
 	int			ret = 0;
 	u8			*digits = NULL;
+	u8			*rx_spare = NULL;
 	u_long			flags;
 
 	hh = mISDN_HEAD_P(skb);
@@ -678,10 +777,10 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 		dsp->data_pending = 0;
 		/* trigger next hdlc frame, if any */
 		if (dsp->hdlc) {
-			spin_lock_irqsave(&dsp_lock, flags);
+			write_lock_irqsave(&dsp_lock, flags);
 			if (dsp->b_active)
 				schedule_work(&dsp->workq);
-			spin_unlock_irqrestore(&dsp_lock, flags);
+			write_unlock_irqrestore(&dsp_lock, flags);
 		}
 		break;
 	case (PH_DATA_IND):
@@ -698,9 +797,9 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 		}
 		if (dsp->hdlc) {
 			/* hdlc */
-			spin_lock_irqsave(&dsp_lock, flags);
+			write_lock_irqsave(&dsp_lock, flags);
 			dsp_cmx_hdlc(dsp, skb);
-			spin_unlock_irqrestore(&dsp_lock, flags);
+			write_unlock_irqrestore(&dsp_lock, flags);
 			if (dsp->rx_disabled) {
 				/* if receive is not allowed */
 				break;
@@ -711,63 +810,38 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 			break;
 		}
 
-		spin_lock_irqsave(&dsp_lock, flags);
+		/* data may be shared with other receivers, so we must
+		 * unshare it before processing in place */
+		if ((dsp->bf_enable || dsp->pipeline.inuse || dsp->rx_volume)
+		    && skb_cloned(skb)) {
+			skb = skb_unshare(skb, GFP_ATOMIC);
+			if (!skb)
+				return 0;
+			hh = mISDN_HEAD_P(skb);
+		}
+
+		read_lock_irqsave(&dsp_lock, flags);
 
+		/* the pipeline is run by the ec worker of this dsp, while
+		 * frames are queued there, the others must not overtake */
+		if (dsp_ec_workers && ((dsp->pipeline.inuse && dsp->b_active) ||
+				       atomic_read(&dsp->ec_queued))) {
+			dsp_ec_queue(dsp, skb);
+			read_unlock_irqrestore(&dsp_lock, flags);
+			return 0;
+		}
 		/* decrypt if enabled */
 		if (dsp->bf_enable)
 			dsp_bf_decrypt(dsp, skb->data, skb->len);
 		/* pipeline */
 		if (dsp->pipeline.inuse)
 			dsp_pipeline_process_rx(&dsp->pipeline, skb->data,
-						skb->len, hh->id);
-		/* change volume if requested */
-		if (dsp->rx_volume)
-			dsp_change_volume(skb, dsp->rx_volume);
-		/* check if dtmf soft decoding is turned on */
-		if (dsp->dtmf.software) {
-			digits = dsp_dtmf_goertzel_decode(dsp, skb->data,
-							  skb->len, (dsp_options & DSP_OPT_ULAW) ? 1 : 0);
-		}
-		/* we need to process receive data if software */
-		if (dsp->conf && dsp->conf->software) {
-			/* process data from card at cmx */
-			dsp_cmx_receive(dsp, skb);
-		}
+						skb->len, hh->id,
+						dsp->pipeline.tx_count);
 
-		spin_unlock_irqrestore(&dsp_lock, flags);
+		read_unlock_irqrestore(&dsp_lock, flags);
 
-		/* send dtmf result, if any */
-		if (digits) {
-			while (*digits) {
-				int k;
-				struct sk_buff *nskb;
-				if (dsp_debug & DEBUG_DSP_DTMF)
-					printk(KERN_DEBUG "%s: digit"
-					       "(%c) to layer %s\n",
-					       __func__, *digits, dsp->name);
-				k = *digits | DTMF_TONE_VAL;
-				nskb = _alloc_mISDN_skb(PH_CONTROL_IND,
-							MISDN_ID_ANY, sizeof(int), &k,
-							GFP_ATOMIC);
-				if (nskb) {
-					if (dsp->up) {
-						if (dsp->up->send(
-							    dsp->up, nskb))
-							dev_kfree_skb(nskb);
-					} else
-						dev_kfree_skb(nskb);
-				}
-				digits++;
-			}
-		}
-		if (dsp->rx_disabled) {
-			/* if receive is not allowed */
-			break;
-		}
-		hh->prim = DL_DATA_IND;
-		if (dsp->up)
-			return dsp->up->send(dsp->up, skb);
-		break;
+		return dsp_rx_finish(dsp, skb);
 	case (PH_CONTROL_IND):
 		if (dsp_debug & DEBUG_DSP_DTMFCOEFF)
 			printk(KERN_DEBUG "%s: PH_CONTROL INDICATION "
@@ -811,7 +885,7 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 				ret = -EINVAL;
 				break;
 			}
-			spin_lock_irqsave(&dsp_lock, flags);
+			write_lock_irqsave(&dsp_lock, flags);
 			dsp->tx_volume = *((int *)skb->data);
 			if (dsp_debug & DEBUG_DSP_CORE)
 				printk(KERN_DEBUG "%s: change tx volume to "
@@ -819,7 +893,7 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 			dsp_cmx_hardware(dsp->conf, dsp);
 			dsp_dtmf_hardware(dsp);
 			dsp_rx_off(dsp);
-			spin_unlock_irqrestore(&dsp_lock, flags);
+			write_unlock_irqrestore(&dsp_lock, flags);
 			break;
 		default:
 			if (dsp_debug & DEBUG_DSP_CORE)
@@ -834,18 +908,19 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 			printk(KERN_DEBUG "%s: b_channel is now active %s\n",
 			       __func__, dsp->name);
 		/* bchannel now active */
-		spin_lock_irqsave(&dsp_lock, flags);
+		write_lock_irqsave(&dsp_lock, flags);
 		dsp->b_active = 1;
 		dsp->data_pending = 0;
 		dsp->rx_init = 1;
 		/* rx_W and rx_R will be adjusted on first frame */
 		dsp->rx_W = 0;
 		dsp->rx_R = 0;
-		memset(dsp->rx_buff, 0, sizeof(dsp->rx_buff));
+		if (dsp->rx_buff)
+			memset(dsp->rx_buff, 0, CMX_BUFF_SIZE);
 		dsp_cmx_hardware(dsp->conf, dsp);
 		dsp_dtmf_hardware(dsp);
 		dsp_rx_off(dsp);
-		spin_unlock_irqrestore(&dsp_lock, flags);
+		write_unlock_irqrestore(&dsp_lock, flags);
 		if (dsp_debug & DEBUG_DSP_CORE)
 			printk(KERN_DEBUG "%s: done with activation, sending "
 			       "confirm to user space. %s\n", __func__,
@@ -861,12 +936,12 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 			printk(KERN_DEBUG "%s: b_channel is now inactive %s\n",
 			       __func__, dsp->name);
 		/* bchannel now inactive */
-		spin_lock_irqsave(&dsp_lock, flags);
+		write_lock_irqsave(&dsp_lock, flags);
 		dsp->b_active = 0;
 		dsp->data_pending = 0;
 		dsp_cmx_hardware(dsp->conf, dsp);
 		dsp_rx_off(dsp);
-		spin_unlock_irqrestore(&dsp_lock, flags);
+		write_unlock_irqrestore(&dsp_lock, flags);
 		hh->prim = DL_RELEASE_CNF;
 		if (dsp->up)
 			return dsp->up->send(dsp->up, skb);
@@ -885,23 +960,33 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 				break;
 			}
 			hh->prim = PH_DATA_REQ;
-			spin_lock_irqsave(&dsp_lock, flags);
+			write_lock_irqsave(&dsp_lock, flags);
 			skb_queue_tail(&dsp->sendq, skb);
 			schedule_work(&dsp->workq);
-			spin_unlock_irqrestore(&dsp_lock, flags);
+			write_unlock_irqrestore(&dsp_lock, flags);
 			return 0;
 		}
 		/* send data to tx-buffer (if no tone is played) */
 		if (!dsp->tone.tone) {
-			spin_lock_irqsave(&dsp_lock, flags);
+			read_lock_irqsave(&dsp_lock, flags);
 			dsp_cmx_transmit(dsp, skb);
-			spin_unlock_irqrestore(&dsp_lock, flags);
+			read_unlock_irqrestore(&dsp_lock, flags);
 		}
 		break;
 	case (PH_CONTROL_REQ):
-		spin_lock_irqsave(&dsp_lock, flags);
+		/* a conference member needs an rx ring, it is too large for
+		 * an atomic allocation under dsp_lock */
+		if (skb->len >= 2 * sizeof(int) &&
+		    *((int *)skb->data) == DSP_CONF_JOIN &&
+		    *((u32 *)skb->data + 1))
+			rx_spare = dsp_cmx_ring_alloc(GFP_KERNEL);
+		write_lock_irqsave(&dsp_lock, flags);
+		dsp->rx_spare = rx_spare;
 		ret = dsp_control_req(dsp, hh, skb);
-		spin_unlock_irqrestore(&dsp_lock, flags);
+		rx_spare = dsp->rx_spare; /* not used */
+		dsp->rx_spare = NULL;
+		write_unlock_irqrestore(&dsp_lock, flags);
+		dsp_cmx_ring_free(rx_spare);
 		break;
 	case (DL_ESTABLISH_REQ):
 	case (PH_ACTIVATE_REQ):
@@ -924,7 +1009,7 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 		if (dsp_debug & DEBUG_DSP_CORE)
 			printk(KERN_DEBUG "%s: releasing b_channel %s\n",
 			       __func__, dsp->name);
-		spin_lock_irqsave(&dsp_lock, flags);
+		write_lock_irqsave(&dsp_lock, flags);
 		dsp->tone.tone = 0;
 		dsp->tone.hardware = 0;
 		dsp->tone.software = 0;
@@ -934,7 +1019,7 @@ dsp_function(struct mISDNchannel *ch,  struct sk_buff *skb)
 			dsp_cmx_conf(dsp, 0); /* dsp_cmx_hardware will also be
 						 called here */
 		skb_queue_purge(&dsp->sendq);
-		spin_unlock_irqrestore(&dsp_lock, flags);
+		write_unlock_irqrestore(&dsp_lock, flags);
 		hh->prim = PH_DEACTIVATE_REQ;
 		if (ch->peer)
 			return ch->recv(ch->peer, skb);
@@ -970,12 +1055,13 @@ dsp_ctrl(struct mISDNchannel *ch, u_int cmd, void *arg)
 		/* wait until workqueue has finished,
 		 * must lock here, or we may hit send-process currently
 		 * queueing. */
-		spin_lock_irqsave(&dsp_lock, flags);
+		write_lock_irqsave(&dsp_lock, flags);
 		dsp->b_active = 0;
-		spin_unlock_irqrestore(&dsp_lock, flags);
+		write_unlock_irqrestore(&dsp_lock, flags);
 		/* MUST not be locked, because it waits until queue is done. */
 		cancel_work_sync(&dsp->workq);
-		spin_lock_irqsave(&dsp_lock, flags);
+		dsp_ec_flush(dsp);
+		write_lock_irqsave(&dsp_lock, flags);
 		if (timer_pending(&dsp->tone.tl))
 			del_timer(&dsp->tone.tl);
 		skb_queue_purge(&dsp->sendq);
@@ -991,12 +1077,16 @@ dsp_ctrl(struct mISDNchannel *ch, u_int cmd, void *arg)
 			printk(KERN_DEBUG "%s: remove & destroy object %s\n",
 			       __func__, dsp->name);
 		list_del(&dsp->list);
-		spin_unlock_irqrestore(&dsp_lock, flags);
+		dsp_cmx_del_worker_dsp(dsp);
+		write_unlock_irqrestore(&dsp_lock, flags);
 
 		if (dsp_debug & DEBUG_DSP_CTRL)
 			printk(KERN_DEBUG "%s: dsp instance released\n",
 			       __func__);
-		vfree(dsp);
+		dsp_cmx_ring_free(dsp->tx_buff);
+		dsp_cmx_ring_free(dsp->rx_buff);
+		kfree(dsp->bf);
+		mISDN_cache_free(&dsp_cache, dsp);
 		module_put(THIS_MODULE);
 		break;
 	}
@@ -1046,6 +1136,16 @@ dsp_send_bh(struct work_struct *work)
 	}
 }
 
+static void
+dsp_ctor(void *obj)
+{
+	struct dsp *dsp = obj;
+
+	memset(dsp, 0, sizeof(*dsp));
+	INIT_WORK(&dsp->workq, (void *)dsp_send_bh);
+	skb_queue_head_init(&dsp->sendq);
+}
+
 static int
 dspcreate(struct channel_req *crq)
 {
@@ -1055,17 +1155,26 @@ dspcreate(struct channel_req *crq)
 	if (crq->protocol != ISDN_P_B_L2DSP
 	    && crq->protocol != ISDN_P_B_L2DSPHDLC)
 		return -EPROTONOSUPPORT;
-	ndsp = vzalloc(sizeof(struct dsp));
+	ndsp = mISDN_cache_alloc(&dsp_cache, GFP_KERNEL);
 	if (!ndsp) {
-		printk(KERN_ERR "%s: vmalloc struct dsp failed\n", __func__);
+		printk(KERN_ERR "%s: alloc struct dsp failed\n",
+		       __func__);
 		return -ENOMEM;
 	}
+	/* the tx buffer is only used for transparent data */
+	if (crq->protocol == ISDN_P_B_L2DSP) {
+		ndsp->tx_buff = dsp_cmx_ring_alloc(GFP_KERNEL);
+		if (!ndsp->tx_buff) {
+			printk(KERN_ERR "%s: alloc tx buffer failed\n",
+			       __func__);
+			mISDN_cache_free(&dsp_cache, ndsp);
+			return -ENOMEM;
+		}
+	}
 	if (dsp_debug & DEBUG_DSP_CTRL)
 		printk(KERN_DEBUG "%s: creating new dsp instance\n", __func__);
 
 	/* default enabled */
-	INIT_WORK(&ndsp->workq, (void *)dsp_send_bh);
-	skb_queue_head_init(&ndsp->sendq);
 	ndsp->ch.send = dsp_function;
 	ndsp->ch.ctrl = dsp_ctrl;
 	ndsp->up = crq->ch;
@@ -1099,10 +1208,13 @@ dspcreate(struct channel_req *crq)
 	ndsp->dtmf.treshold = dtmfthreshold * 10000;
 
 	/* init pipeline append to list */
-	spin_lock_irqsave(&dsp_lock, flags);
+	write_lock_irqsave(&dsp_lock, flags);
 	dsp_pipeline_init(&ndsp->pipeline);
+	ndsp->cmx_worker = dsp_cmx_assign_worker();
+	dsp_cmx_add_worker_dsp(ndsp);
+	ndsp->ec_worker = dsp_ec_assign_worker();
 	list_add_tail(&ndsp->list, &dsp_ilist);
-	spin_unlock_irqrestore(&dsp_lock, flags);
+	write_unlock_irqrestore(&dsp_lock, flags);
 
 	return 0;
 }
@@ -1141,13 +1253,16 @@ static int __init dsp_init(void)
 			return err;
 		}
 		dsp_tics = poll * HZ / 8000;
-		if (dsp_tics * 8000 != poll * HZ) {
+		if (!hrclock && dsp_tics * 8000 != poll * HZ) {
 			printk(KERN_INFO "mISDN_dsp: Cannot clock every %d "
 			       "samples (0,125 ms). It is not a multiple of "
 			       "%d HZ.\n", poll, HZ);
 			err = -EINVAL;
 			return err;
 		}
+	} else if (hrclock) {
+		/* high resolution clock is not bound to HZ, use 1 ms */
+		dsp_poll = 8;
 	} else {
 		poll = 8;
 		while (poll <= MAX_POLL) {
@@ -1169,13 +1284,49 @@ static int __init dsp_init(void)
 		err = -EINVAL;
 		return err;
 	}
-	printk(KERN_INFO "mISDN_dsp: DSP clocks every %d samples. This equals "
-	       "%d jiffies.\n", dsp_poll, dsp_tics);
-
-	spin_lock_init(&dsp_lock);
+	if (hrclock)
+		printk(KERN_INFO "mISDN_dsp: DSP clocks every %d samples. This "
+		       "equals %d us (high resolution timer).\n", dsp_poll,
+		       dsp_poll * 125);
+	else
+		printk(KERN_INFO "mISDN_dsp: DSP clocks every %d samples. This "
+		       "equals %d jiffies.\n", dsp_poll, dsp_tics);
+
+	rwlock_init(&dsp_lock);
 	INIT_LIST_HEAD(&dsp_ilist);
 	INIT_LIST_HEAD(&conf_ilist);
 
+	err = mISDN_cache_create(&dsp_cache, "mISDN_dsp", sizeof(struct dsp),
+				 dsp_ctor);
+	if (err)
+		return err;
+	err = dsp_cmx_init_caches();
+	if (err) {
+		mISDN_cache_destroy(&dsp_cache);
+		return err;
+	}
+
+	err = dsp_cmx_init_workers(cmxworkers);
+	if (err) {
+		dsp_cmx_cleanup_caches();
+		mISDN_cache_destroy(&dsp_cache);
+		return err;
+	}
+	if (dsp_cmx_workers)
+		printk(KERN_INFO "mISDN_dsp: Mixing is done by %d cmx "
+		       "workers.\n", dsp_cmx_workers);
+
+	err = dsp_ec_init_workers(ecworkers);
+	if (err) {
+		dsp_cmx_cleanup_workers();
+		dsp_cmx_cleanup_caches();
+		mISDN_cache_destroy(&dsp_cache);
+		return err;
+	}
+	if (dsp_ec_workers)
+		printk(KERN_INFO "mISDN_dsp: Pipelines are processed by %d ec "
+		       "workers.\n", dsp_ec_workers);
+
 	/* init conversion tables */
 	dsp_audio_generate_law_tables();
 	dsp_silence = (dsp_options & DSP_OPT_ULAW) ? 0xff : 0x2a;
@@ -1187,21 +1338,41 @@ static int __init dsp_init(void)
 	if (dsp_options & DSP_OPT_ULAW)
 		dsp_audio_generate_ulaw_samples();
 	dsp_audio_generate_volume_changes();
+	dsp_mix_init();
 
 	err = dsp_pipeline_module_init();
 	if (err) {
 		printk(KERN_ERR "mISDN_dsp: Can't initialize pipeline, "
 		       "error(%d)\n", err);
+		dsp_ec_cleanup_workers();
+		dsp_cmx_cleanup_workers();
+		dsp_cmx_cleanup_caches();
+		mISDN_cache_destroy(&dsp_cache);
 		return err;
 	}
 
 	err = mISDN_register_Bprotocol(&DSP);
 	if (err) {
 		printk(KERN_ERR "Can't register %s error(%d)\n", DSP.name, err);
+		dsp_pipeline_module_exit();
+		dsp_ec_cleanup_workers();
+		dsp_cmx_cleanup_workers();
+		dsp_cmx_cleanup_caches();
+		mISDN_cache_destroy(&dsp_cache);
 		return err;
 	}
 
 	/* set sample timer */
+	if (hrclock) {
+		dsp_spl_period = ktime_set(0, dsp_poll * 125000);
+		hrtimer_init(&dsp_spl_hrtimer, CLOCK_MONOTONIC,
+			     HRTIMER_MODE_ABS);
+		dsp_spl_hrtimer.function = dsp_cmx_hrsend;
+		hrtimer_start(&dsp_spl_hrtimer,
+			      ktime_add(ktime_get(), dsp_spl_period),
+			      HRTIMER_MODE_ABS);
+		return 0;
+	}
 	dsp_spl_tl.function = (void *)dsp_cmx_send;
 	dsp_spl_tl.data = 0;
 	init_timer(&dsp_spl_tl);
@@ -1217,7 +1388,14 @@ static void __exit dsp_cleanup(void)
 {
 	mISDN_unregister_Bprotocol(&DSP);
 
-	del_timer_sync(&dsp_spl_tl);
+	if (hrclock) {
+		hrtimer_cancel(&dsp_spl_hrtimer);
+		tasklet_kill(&dsp_spl_tasklet);
+	} else {
+		del_timer_sync(&dsp_spl_tl);
+	}
+	dsp_cmx_cleanup_workers();
+	dsp_ec_cleanup_workers();
 
 	if (!list_empty(&dsp_ilist)) {
 		printk(KERN_ERR "mISDN_dsp: Audio DSP object inst list not "
@@ -1229,6 +1407,8 @@ static void __exit dsp_cleanup(void)
 	}
 
 	dsp_pipeline_module_exit();
+	dsp_cmx_cleanup_caches();
+	mISDN_cache_destroy(&dsp_cache);
 }
 
 module_init(dsp_init);
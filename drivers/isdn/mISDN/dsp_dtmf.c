@@ -139,10 +139,13 @@ again:
 	switch (fmt) {
 	case 0: /* alaw */
 	case 1: /* ulaw */
-		while (size < DSP_DTMF_NPOINTS && len) {
-			buf[size++] = dsp_audio_law_to_s32[*data++];
-			len--;
-		}
+		i = DSP_DTMF_NPOINTS - size;
+		if (i > len)
+			i = len;
+		dsp_audio_decode(buf + size, data, i);
+		size += i;
+		data += i;
+		len -= i;
 		break;
 
 	case 2: /* HFC coefficients */
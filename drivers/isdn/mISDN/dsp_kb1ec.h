@@ -572,6 +572,16 @@ echo_can_update(struct echo_can_state *ec, short iref, short isig)
 	return u;
 }
 
+static inline void
+echo_can_update_block(struct echo_can_state *ec, const short *iref,
+		      const short *isig, short *out, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		out[i] = echo_can_update(ec, iref[i], isig[i]);
+}
+
 static inline struct echo_can_state *echo_can_create(int len, int adaption_mode)
 {
 	struct echo_can_state *ec;
@@ -0,0 +1,273 @@
+/*
+ * Conference mixing kernels for mISDN_dsp.
+ *
+ * The conference is mixed in linear samples. Each member's rx-data is
+ * decoded once, all members are summed, and for each member its own
+ * contribution is removed and its tx-data is added with saturation.
+ * On x86_64 the sum and the member loops use SSE2 or AVX2, if the cpu
+ * supports it. Law conversion is done by the bulk functions of
+ * dsp_audio.c, which use the same simd level.
+ *
+ * This software may be used and distributed according to the terms
+ * of the GNU General Public License, incorporated herein by reference.
+ *
+ */
+
+#include <linux/interrupt.h>
+#include <linux/export.h>
+#include <linux/percpu.h>
+#include <linux/mISDNif.h>
+#include <linux/mISDNdsp.h>
+#include "core.h"
+#include "dsp.h"
+#ifdef CONFIG_X86_64
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#endif
+
+int dsp_mix_level = DSP_MIX_SCALAR;
+
+/* linear silence, used if a member has no data to add or subtract */
+const s16 dsp_mix_silence[MAX_POLL + 100];
+
+#ifdef CONFIG_X86_64
+/*
+ * returns the number of samples processed by simd, the remaining samples
+ * must be processed by the scalar loop
+ */
+static int
+dsp_mix_sum_simd(s32 *sum, const s16 *lin, int len)
+{
+	int i = 0;
+
+	if (dsp_mix_level == DSP_MIX_AVX2) {
+		for (; i + 16 <= len; i += 16) {
+			asm volatile(
+				"vpmovsxwd (%1), %%ymm0\n\t"
+				"vpmovsxwd 16(%1), %%ymm1\n\t"
+				"vpaddd (%0), %%ymm0, %%ymm0\n\t"
+				"vpaddd 32(%0), %%ymm1, %%ymm1\n\t"
+				"vmovdqu %%ymm0, (%0)\n\t"
+				"vmovdqu %%ymm1, 32(%0)\n\t"
+				: : "r" (sum + i), "r" (lin + i)
+				: "memory", "xmm0", "xmm1");
+		}
+		asm volatile("vzeroupper" : : : "memory");
+		return i;
+	}
+	for (; i + 8 <= len; i += 8) {
+		/* sign extend words by unpacking to the high word */
+		asm volatile(
+			"movdqu (%1), %%xmm0\n\t"
+			"movdqa %%xmm0, %%xmm1\n\t"
+			"punpcklwd %%xmm0, %%xmm0\n\t"
+			"punpckhwd %%xmm1, %%xmm1\n\t"
+			"psrad $16, %%xmm0\n\t"
+			"psrad $16, %%xmm1\n\t"
+			"movdqu (%0), %%xmm2\n\t"
+			"movdqu 16(%0), %%xmm3\n\t"
+			"paddd %%xmm2, %%xmm0\n\t"
+			"paddd %%xmm3, %%xmm1\n\t"
+			"movdqu %%xmm0, (%0)\n\t"
+			"movdqu %%xmm1, 16(%0)\n\t"
+			: : "r" (sum + i), "r" (lin + i)
+			: "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+	}
+	return i;
+}
+
+static int
+dsp_mix_member_simd(s16 *out, const s32 *sum, const s16 *sub,
+		    const s16 *add, int len)
+{
+	int i = 0;
+
+	if (dsp_mix_level == DSP_MIX_AVX2) {
+		for (; i + 16 <= len; i += 16) {
+			/* vpackssdw packs per lane, vpermq restores order */
+			asm volatile(
+				"vmovdqu (%1), %%ymm0\n\t"
+				"vmovdqu 32(%1), %%ymm1\n\t"
+				"vpmovsxwd (%2), %%ymm2\n\t"
+				"vpmovsxwd 16(%2), %%ymm3\n\t"
+				"vpsubd %%ymm2, %%ymm0, %%ymm0\n\t"
+				"vpsubd %%ymm3, %%ymm1, %%ymm1\n\t"
+				"vpmovsxwd (%3), %%ymm2\n\t"
+				"vpmovsxwd 16(%3), %%ymm3\n\t"
+				"vpaddd %%ymm2, %%ymm0, %%ymm0\n\t"
+				"vpaddd %%ymm3, %%ymm1, %%ymm1\n\t"
+				"vpackssdw %%ymm1, %%ymm0, %%ymm0\n\t"
+				"vpermq $0xd8, %%ymm0, %%ymm0\n\t"
+				"vmovdqu %%ymm0, (%0)\n\t"
+				: : "r" (out + i), "r" (sum + i), "r" (sub + i),
+				  "r" (add + i)
+				: "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+		}
+		asm volatile("vzeroupper" : : : "memory");
+		return i;
+	}
+	for (; i + 8 <= len; i += 8) {
+		asm volatile(
+			"movdqu (%1), %%xmm0\n\t"
+			"movdqu 16(%1), %%xmm1\n\t"
+			"movdqu (%2), %%xmm2\n\t"
+			"movdqa %%xmm2, %%xmm3\n\t"
+			"punpcklwd %%xmm2, %%xmm2\n\t"
+			"punpckhwd %%xmm3, %%xmm3\n\t"
+			"psrad $16, %%xmm2\n\t"
+			"psrad $16, %%xmm3\n\t"
+			"psubd %%xmm2, %%xmm0\n\t"
+			"psubd %%xmm3, %%xmm1\n\t"
+			"movdqu (%3), %%xmm2\n\t"
+			"movdqa %%xmm2, %%xmm3\n\t"
+			"punpcklwd %%xmm2, %%xmm2\n\t"
+			"punpckhwd %%xmm3, %%xmm3\n\t"
+			"psrad $16, %%xmm2\n\t"
+			"psrad $16, %%xmm3\n\t"
+			"paddd %%xmm2, %%xmm0\n\t"
+			"paddd %%xmm3, %%xmm1\n\t"
+			"packssdw %%xmm1, %%xmm0\n\t"
+			"movdqu %%xmm0, (%0)\n\t"
+			: : "r" (out + i), "r" (sum + i), "r" (sub + i),
+			  "r" (add + i)
+			: "memory", "xmm0", "xmm1", "xmm2", "xmm3");
+	}
+	return i;
+}
+
+/*
+ * fpu sections of the simd functions. while an ec worker holds the fpu for
+ * a batch of frames, the functions called by it just use it. interrupts on
+ * that cpu see the fpu as not usable, bottom halves are disabled.
+ * dsp_fpu_begin() returns 0, if the fpu cannot be used, otherwise the value
+ * for dsp_fpu_end().
+ */
+static DEFINE_PER_CPU(int, dsp_fpu_batch);
+
+int
+dsp_fpu_begin(void)
+{
+	if (!in_irq() && this_cpu_read(dsp_fpu_batch))
+		return 2;
+	if (!irq_fpu_usable())
+		return 0;
+	kernel_fpu_begin();
+	return 1;
+}
+EXPORT_SYMBOL(dsp_fpu_begin);
+
+void
+dsp_fpu_end(int fpu)
+{
+	if (fpu == 1)
+		kernel_fpu_end();
+}
+EXPORT_SYMBOL(dsp_fpu_end);
+
+int
+dsp_fpu_batch_begin(void)
+{
+	local_bh_disable();
+	if (!irq_fpu_usable()) {
+		local_bh_enable();
+		return 0;
+	}
+	kernel_fpu_begin();
+	this_cpu_write(dsp_fpu_batch, 1);
+	return 1;
+}
+
+void
+dsp_fpu_batch_end(int fpu)
+{
+	if (!fpu)
+		return;
+	this_cpu_write(dsp_fpu_batch, 0);
+	kernel_fpu_end();
+	local_bh_enable();
+}
+#endif
+
+/*
+ * decode len samples of a ring buffer, starting at pos, into linear samples
+ */
+void
+dsp_mix_decode(s16 *lin, const u8 *buff, int pos, int len)
+{
+	int n = CMX_BUFF_SIZE - pos;
+
+	if (n > len)
+		n = len;
+	dsp_audio_decode(lin, buff + pos, n);
+	if (n < len)
+		dsp_audio_decode(lin + n, buff, len - n);
+}
+
+/*
+ * add linear samples of a member to the conference sum
+ */
+void
+dsp_mix_sum(s32 *sum, const s16 *lin, int len)
+{
+	int i = 0;
+
+#ifdef CONFIG_X86_64
+	if (dsp_mix_level != DSP_MIX_SCALAR && len >= 8) {
+		int fpu = dsp_fpu_begin();
+
+		if (fpu)
+			i = dsp_mix_sum_simd(sum, lin, len);
+		dsp_fpu_end(fpu);
+	}
+#endif
+	for (; i < len; i++)
+		sum[i] += lin[i];
+}
+
+/*
+ * calculate the output of a member: sum - sub + add, saturated to 16 bits
+ * (sub is the member's own rx-data, add is its tx-data)
+ */
+void
+dsp_mix_member(s16 *out, const s32 *sum, const s16 *sub, const s16 *add,
+	       int len)
+{
+	register s32 sample;
+	int i = 0;
+
+#ifdef CONFIG_X86_64
+	if (dsp_mix_level != DSP_MIX_SCALAR && len >= 8) {
+		int fpu = dsp_fpu_begin();
+
+		if (fpu)
+			i = dsp_mix_member_simd(out, sum, sub, add, len);
+		dsp_fpu_end(fpu);
+	}
+#endif
+	for (; i < len; i++) {
+		sample = sum[i] - sub[i] + add[i];
+		if (sample < -32768)
+			sample = -32768;
+		else if (sample > 32767)
+			sample = 32767;
+		out[i] = sample;
+	}
+}
+
+void
+dsp_mix_init(void)
+{
+#ifdef CONFIG_X86_64
+	if (boot_cpu_has(X86_FEATURE_AVX2) &&
+	    cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL))
+		dsp_mix_level = DSP_MIX_AVX2;
+	else if (boot_cpu_has(X86_FEATURE_XMM2))
+		dsp_mix_level = DSP_MIX_SSE2;
+#endif
+	if (dsp_mix_level == DSP_MIX_AVX2)
+		printk(KERN_INFO "mISDN_dsp: Conferences are mixed using "
+		       "AVX2.\n");
+	else if (dsp_mix_level == DSP_MIX_SSE2)
+		printk(KERN_INFO "mISDN_dsp: Conferences are mixed using "
+		       "SSE2.\n");
+}
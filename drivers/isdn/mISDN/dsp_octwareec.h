@@ -86,6 +86,14 @@ echo_can_update(struct echo_can_state *ec, short iref, short isig)
 	    iref, isig);
 }
 
+static inline void
+echo_can_update_block(struct echo_can_state *ec, const short *iref,
+		      const short *isig, short *out, int n)
+{
+	ZapOctVqeApiEcChannelProcessBlock(ec->pvOctvqeEchoCanceller,
+	    iref, isig, out, n);
+}
+
 static inline void
 echo_can_free(struct echo_can_state *ec)
 {
@@ -35,6 +35,7 @@
 #define echo_can_create oslec_echo_can_create
 #define echo_can_free oslec_echo_can_free
 #define echo_can_update oslec_echo_can_update
+#define echo_can_update_block oslec_echo_can_update_block
 #define echo_can_traintap oslec_echo_can_traintap
 #include "dsp_cancel.h"
 
@@ -121,6 +122,7 @@ static struct mISDN_dsp_element dsp_oslec = {
 #ifdef MODULE
 static int __init dsp_oslec_init(void)
 {
+	oslec_simd_init();
 	mISDN_dsp_element_register(&dsp_oslec);
 
 	return 0;
@@ -31,6 +31,7 @@
 #include <linux/mISDNif.h>
 #include <linux/mISDNdsp.h>
 #include <linux/export.h>
+#include <linux/workqueue.h>
 #include "dsp.h"
 #include "dsp_hwec.h"
 
@@ -197,6 +198,7 @@ int dsp_pipeline_init(struct dsp_pipeline *pipeline)
 		return -EINVAL;
 
 	INIT_LIST_HEAD(&pipeline->list);
+	spin_lock_init(&pipeline->lock);
 
 #ifdef PIPELINE_DEBUG
 	printk(KERN_DEBUG "%s: dsp pipeline ready\n", __func__);
@@ -335,20 +337,211 @@ void dsp_pipeline_process_tx(struct dsp_pipeline *pipeline, u8 *data, int len)
 	if (!pipeline)
 		return;
 
+	/* rx is processed outside the cmx, so serialize with it */
+	spin_lock(&pipeline->lock);
 	list_for_each_entry(entry, &pipeline->list, list)
 		if (entry->elem->process_tx)
 			entry->elem->process_tx(entry->p, data, len);
+	pipeline->tx_count += len;
+	spin_unlock(&pipeline->lock);
 }
 
+/*
+ * tx_count is the tx count of the pipeline when the data was received.
+ * if the data is processed later, the tx elements have advanced meanwhile,
+ * so the difference is added to the tx delay for the echo cancellers.
+ */
 void dsp_pipeline_process_rx(struct dsp_pipeline *pipeline, u8 *data, int len,
-			     unsigned int txlen)
+			     unsigned int txlen, unsigned int tx_count)
 {
 	struct dsp_pipeline_entry *entry;
 
 	if (!pipeline)
 		return;
 
+	if (txlen > 0xf000) /* if not supported */
+		txlen = 0;
+	spin_lock(&pipeline->lock);
+	txlen += pipeline->tx_count - tx_count;
 	list_for_each_entry_reverse(entry, &pipeline->list, list)
 		if (entry->elem->process_rx)
 			entry->elem->process_rx(entry->p, data, len, txlen);
+	spin_unlock(&pipeline->lock);
+}
+
+/*
+ * ec workers
+ */
+
+int dsp_ec_workers; /* number of ec workers, 0 = run pipelines in rx path */
+static struct dsp_ec_worker *dsp_ec_worker;
+static int dsp_ec_next_worker; /* worker for the next dsp */
+static struct workqueue_struct *dsp_ec_wq;
+
+/* max frames per fpu section, so preemption and bottom halves are not
+ * held off for too long */
+#define DSP_EC_BATCH	32
+
+/*
+ * ec worker: runs the rx pipelines of up to DSP_EC_BATCH queued frames in one
+ * fpu section, so the simd kernels of the echo cancellers need not save the
+ * fpu state for each frame. the rest of the rx path is done outside.
+ */
+static void
+dsp_ec_work(struct work_struct *work)
+{
+	struct dsp_ec_worker *worker =
+		container_of(work, struct dsp_ec_worker, w.work);
+	struct sk_buff_head batch;
+	struct sk_buff *skb;
+	struct dsp *dsp;
+	u_long flags;
+	int fpu, more;
+
+	__skb_queue_head_init(&batch);
+	spin_lock_irqsave(&worker->queue.lock, flags);
+	while (skb_queue_len(&batch) < DSP_EC_BATCH &&
+	       (skb = __skb_dequeue(&worker->queue)))
+		__skb_queue_tail(&batch, skb);
+	more = !skb_queue_empty(&worker->queue);
+	spin_unlock_irqrestore(&worker->queue.lock, flags);
+
+	fpu = dsp_fpu_batch_begin();
+	skb_queue_walk(&batch, skb) {
+		dsp = DSP_EC_CB(skb)->dsp;
+		read_lock_irqsave(&dsp_lock, flags);
+		if (dsp->bf_enable)
+			dsp_bf_decrypt(dsp, skb->data, skb->len);
+		if (dsp->pipeline.inuse)
+			dsp_pipeline_process_rx(&dsp->pipeline, skb->data,
+						skb->len, mISDN_HEAD_ID(skb),
+						DSP_EC_CB(skb)->tx_count);
+		read_unlock_irqrestore(&dsp_lock, flags);
+	}
+	dsp_fpu_batch_end(fpu);
+
+	/* upper layers expect received data from bottom half context */
+	local_bh_disable();
+	while ((skb = __skb_dequeue(&batch))) {
+		dsp = DSP_EC_CB(skb)->dsp;
+		if (dsp_rx_finish(dsp, skb))
+			dev_kfree_skb(skb);
+		/* the rx path may go inline again, if this was the last */
+		atomic_dec(&dsp->ec_queued);
+	}
+	local_bh_enable();
+
+	/* let other work run before the next batch */
+	if (more)
+		dsp_worker_queue(dsp_ec_wq, &worker->w);
+}
+
+/*
+ * queue received data at the worker of the dsp instance, must be called with
+ * dsp_lock held, and not after the instance is flushed
+ */
+void
+dsp_ec_queue(struct dsp *dsp, struct sk_buff *skb)
+{
+	struct dsp_ec_worker *worker = &dsp_ec_worker[dsp->ec_worker];
+
+	DSP_EC_CB(skb)->dsp = dsp;
+	DSP_EC_CB(skb)->tx_count = dsp->pipeline.tx_count;
+	atomic_inc(&dsp->ec_queued);
+	skb_queue_tail(&worker->queue, skb);
+	dsp_worker_queue(dsp_ec_wq, &worker->w);
+}
+
+/*
+ * drop the queued data of a closed dsp instance and wait until the data the
+ * worker has taken already is processed, must not be called with dsp_lock
+ * held
+ */
+void
+dsp_ec_flush(struct dsp *dsp)
+{
+	struct dsp_ec_worker *worker;
+	struct sk_buff_head purge;
+	struct sk_buff *skb, *tmp;
+	u_long flags;
+
+	if (!dsp_ec_workers)
+		return;
+	worker = &dsp_ec_worker[dsp->ec_worker];
+	__skb_queue_head_init(&purge);
+	/* the worker requeues itself, so flush_work alone may miss frames */
+	spin_lock_irqsave(&worker->queue.lock, flags);
+	skb_queue_walk_safe(&worker->queue, skb, tmp) {
+		if (DSP_EC_CB(skb)->dsp != dsp)
+			continue;
+		__skb_unlink(skb, &worker->queue);
+		__skb_queue_tail(&purge, skb);
+		atomic_dec(&dsp->ec_queued);
+	}
+	spin_unlock_irqrestore(&worker->queue.lock, flags);
+	__skb_queue_purge(&purge);
+	flush_work(&worker->w.work);
+}
+
+/*
+ * the worker of a new dsp instance, must be called with dsp_lock held for
+ * writing
+ */
+int
+dsp_ec_assign_worker(void)
+{
+	int nr;
+
+	if (!dsp_ec_workers)
+		return 0;
+	nr = dsp_ec_next_worker;
+	if (++dsp_ec_next_worker >= dsp_ec_workers)
+		dsp_ec_next_worker = 0;
+	return nr;
+}
+
+int
+dsp_ec_init_workers(int count)
+{
+	int i;
+
+	BUILD_BUG_ON(sizeof(struct dsp_ec_cb) >
+		     sizeof(((struct sk_buff *)0)->cb));
+
+	if (count <= 0)
+		return 0;
+	dsp_ec_worker = dsp_workers_alloc(&count, MAX_EC_WORKERS,
+					  sizeof(struct dsp_ec_worker),
+					  dsp_ec_work);
+	if (!dsp_ec_worker) {
+		printk(KERN_ERR "kcalloc struct dsp_ec_worker failed\n");
+		return -ENOMEM;
+	}
+	dsp_ec_wq = alloc_workqueue("mISDN_ec", WQ_HIGHPRI, 0);
+	if (!dsp_ec_wq) {
+		printk(KERN_ERR "%s: cannot create workqueue\n", __func__);
+		kfree(dsp_ec_worker);
+		dsp_ec_worker = NULL;
+		return -ENOMEM;
+	}
+	for (i = 0; i < count; i++)
+		skb_queue_head_init(&dsp_ec_worker[i].queue);
+	dsp_ec_workers = count;
+	return 0;
+}
+
+void
+dsp_ec_cleanup_workers(void)
+{
+	int i;
+
+	if (!dsp_ec_workers)
+		return;
+	/* all dsp instances are released, so the queues are empty */
+	destroy_workqueue(dsp_ec_wq);
+	for (i = 0; i < dsp_ec_workers; i++)
+		skb_queue_purge(&dsp_ec_worker[i].queue);
+	dsp_ec_workers = 0;
+	kfree(dsp_ec_worker);
+	dsp_ec_worker = NULL;
 }
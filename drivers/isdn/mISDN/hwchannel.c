@@ -42,6 +42,61 @@ dchannel_bh(struct work_struct *ws)
 	}
 }
 
+/* receive buffer size for the current protocol and min/max length */
+static int
+bchannel_rxbuf_len(struct bchannel *bch, int minlen, int maxlen)
+{
+	int len;
+
+	if (test_bit(FLG_TRANSPARENT, &bch->Flags)) {
+		len = 2 * minlen;
+		if (len > maxlen)
+			len = maxlen;
+	} else {
+		/* with HDLC we do not know the length yet */
+		len = maxlen;
+	}
+	return len;
+}
+
+/*
+ * refill the receive buffer pool from process context, so the interrupt
+ * handlers do not need to allocate with GFP_ATOMIC
+ */
+static void
+bchannel_rxpool_fill(struct bchannel *bch)
+{
+	struct sk_buff	*skb;
+	int		len;
+
+	len = bchannel_rxbuf_len(bch, bch->next_minlen, bch->next_maxlen);
+	if (len != bch->rxpool_len) {
+		skb_queue_purge(&bch->rxpool);
+		bch->rxpool_len = len;
+	}
+	while (skb_queue_len(&bch->rxpool) < MISDN_BCH_RXPOOL) {
+		skb = mI_alloc_skb(len, GFP_KERNEL);
+		if (!skb)
+			break;
+		skb_queue_tail(&bch->rxpool, skb);
+	}
+}
+
+static struct sk_buff *
+bchannel_rxpool_get(struct bchannel *bch, int len)
+{
+	struct sk_buff	*skb;
+
+	skb = skb_dequeue(&bch->rxpool);
+	if (skb_queue_len(&bch->rxpool) < MISDN_BCH_RXPOOL / 2)
+		schedule_event(bch, FLG_RXPOOL);
+	if (skb && skb_tailroom(skb) < len) {
+		skb_queue_head(&bch->rxpool, skb);
+		skb = NULL;
+	}
+	return skb;
+}
+
 static void
 bchannel_bh(struct work_struct *ws)
 {
@@ -49,6 +104,9 @@ bchannel_bh(struct work_struct *ws)
 	struct sk_buff	*skb;
 	int		err;
 
+	if (test_and_clear_bit(FLG_RXPOOL, &bch->Flags))
+		bchannel_rxpool_fill(bch);
+
 	if (test_and_clear_bit(FLG_RECVQUEUE, &bch->Flags)) {
 		while ((skb = skb_dequeue(&bch->rqueue))) {
 			bch->rcount--;
@@ -97,6 +155,10 @@ mISDN_initbchannel(struct bchannel *ch, unsigned short maxlen,
 	ch->tx_idx = 0;
 	skb_queue_head_init(&ch->rqueue);
 	ch->rcount = 0;
+	ch->rqueue_max = MISDN_BCH_RQUEUE;
+	ch->rx_overflow = 0;
+	skb_queue_head_init(&ch->rxpool);
+	ch->rxpool_len = 0;
 	ch->next_skb = NULL;
 	INIT_WORK(&ch->workq, bchannel_bh);
 	return 0;
@@ -143,6 +205,7 @@ mISDN_clear_bchannel(struct bchannel *ch)
 	test_and_clear_bit(FLG_FILLEMPTY, &ch->Flags);
 	test_and_clear_bit(FLG_TX_EMPTY, &ch->Flags);
 	test_and_clear_bit(FLG_RX_OFF, &ch->Flags);
+	test_and_clear_bit(FLG_RXPOOL, &ch->Flags);
 	ch->dropcnt = 0;
 	ch->minlen = ch->init_minlen;
 	ch->next_minlen = ch->init_minlen;
@@ -150,6 +213,8 @@ mISDN_clear_bchannel(struct bchannel *ch)
 	ch->next_maxlen = ch->init_maxlen;
 	skb_queue_purge(&ch->rqueue);
 	ch->rcount = 0;
+	skb_queue_purge(&ch->rxpool);
+	ch->rxpool_len = 0;
 }
 EXPORT_SYMBOL(mISDN_clear_bchannel);
 
@@ -169,7 +234,7 @@ mISDN_ctrl_bchannel(struct bchannel *bch, struct mISDN_ctrl_req *cq)
 	switch (cq->op) {
 	case MISDN_CTRL_GETOP:
 		cq->op = MISDN_CTRL_RX_BUFFER | MISDN_CTRL_FILL_EMPTY |
-			 MISDN_CTRL_RX_OFF;
+			 MISDN_CTRL_RX_OFF | MISDN_CTRL_RX_QUEUE;
 		break;
 	case MISDN_CTRL_FILL_EMPTY:
 		if (cq->p1) {
@@ -193,10 +258,26 @@ mISDN_ctrl_bchannel(struct bchannel *bch, struct mISDN_ctrl_req *cq)
 			bch->next_maxlen = cq->p2;
 		if (cq->p1 > MISDN_CTRL_RX_SIZE_IGNORE)
 			bch->next_minlen = cq->p1;
+		/* resize the receive buffer pool */
+		schedule_event(bch, FLG_RXPOOL);
 		/* we return the old values */
 		cq->p1 = bch->minlen;
 		cq->p2 = bch->maxlen;
 		break;
+	case MISDN_CTRL_RX_QUEUE:
+		/* p1 new depth, returns old depth and overflow count */
+		if (cq->p1 > MISDN_BCH_RQUEUE_MAX) {
+			ret = -EINVAL;
+			break;
+		}
+		cq->p2 = bch->rx_overflow;
+		bch->rx_overflow = 0;
+		ret = bch->rqueue_max;
+		if (cq->p1 > 0)
+			bch->rqueue_max = cq->p1;
+		cq->p1 = ret;
+		ret = 0;
+		break;
 	default:
 		pr_info("mISDN unhandled control %x operation\n", cq->op);
 		ret = -EINVAL;
@@ -216,6 +297,28 @@ get_sapi_tei(u_char *p)
 	return sapi | (tei << 8);
 }
 
+/* queue a frame upstream, drop the oldest frames if the queue is full */
+static void
+bchannel_queue_rx(struct bchannel *bch, struct sk_buff *skb)
+{
+	struct sk_buff	*old;
+
+	while (skb_queue_len(&bch->rqueue) >= bch->rqueue_max) {
+		old = skb_dequeue(&bch->rqueue);
+		if (!old)
+			break;
+		dev_kfree_skb_any(old);
+		bch->rcount--;
+		bch->rx_overflow++;
+		printk_ratelimited(KERN_WARNING
+				   "B%d receive queue overflow - dropping\n",
+				   bch->nr);
+	}
+	bch->rcount++;
+	skb_queue_tail(&bch->rqueue, skb);
+	schedule_event(bch, FLG_RECVQUEUE);
+}
+
 void
 recv_Dchannel(struct dchannel *dch)
 {
@@ -275,16 +378,8 @@ recv_Bchannel(struct bchannel *bch, unsigned int id, bool force)
 		hh = mISDN_HEAD_P(bch->rx_skb);
 		hh->prim = PH_DATA_IND;
 		hh->id = id;
-		if (bch->rcount >= 64) {
-			printk(KERN_WARNING
-			       "B%d receive queue overflow - flushing!\n",
-			       bch->nr);
-			skb_queue_purge(&bch->rqueue);
-		}
-		bch->rcount++;
-		skb_queue_tail(&bch->rqueue, bch->rx_skb);
+		bchannel_queue_rx(bch, bch->rx_skb);
 		bch->rx_skb = NULL;
-		schedule_event(bch, FLG_RECVQUEUE);
 	}
 }
 EXPORT_SYMBOL(recv_Bchannel);
@@ -300,15 +395,7 @@ EXPORT_SYMBOL(recv_Dchannel_skb);
 void
 recv_Bchannel_skb(struct bchannel *bch, struct sk_buff *skb)
 {
-	if (bch->rcount >= 64) {
-		printk(KERN_WARNING "B-channel %p receive queue overflow, "
-		       "flushing!\n", bch);
-		skb_queue_purge(&bch->rqueue);
-		bch->rcount = 0;
-	}
-	bch->rcount++;
-	skb_queue_tail(&bch->rqueue, skb);
-	schedule_event(bch, FLG_RECVQUEUE);
+	bchannel_queue_rx(bch, skb);
 }
 EXPORT_SYMBOL(recv_Bchannel_skb);
 
@@ -348,12 +435,6 @@ confirm_Bsend(struct bchannel *bch)
 {
 	struct sk_buff	*skb;
 
-	if (bch->rcount >= 64) {
-		printk(KERN_WARNING "B-channel %p receive queue overflow, "
-		       "flushing!\n", bch);
-		skb_queue_purge(&bch->rqueue);
-		bch->rcount = 0;
-	}
 	skb = _alloc_mISDN_skb(PH_DATA_CNF, mISDN_HEAD_ID(bch->tx_skb),
 			       0, NULL, GFP_ATOMIC);
 	if (!skb) {
@@ -361,9 +442,7 @@ confirm_Bsend(struct bchannel *bch)
 		       mISDN_HEAD_ID(bch->tx_skb));
 		return;
 	}
-	bch->rcount++;
-	skb_queue_tail(&bch->rqueue, skb);
-	schedule_event(bch, FLG_RECVQUEUE);
+	bchannel_queue_rx(bch, skb);
 }
 
 int
@@ -503,18 +582,14 @@ bchannel_get_rxbuf(struct bchannel *bch, int reqlen)
 		bch->minlen = bch->next_minlen;
 	if (unlikely(reqlen > bch->maxlen))
 		return -EMSGSIZE;
-	if (test_bit(FLG_TRANSPARENT, &bch->Flags)) {
-		if (reqlen >= bch->minlen) {
-			len = reqlen;
-		} else {
-			len = 2 * bch->minlen;
-			if (len > bch->maxlen)
-				len = bch->maxlen;
-		}
-	} else {
-		/* with HDLC we do not know the length yet */
-		len = bch->maxlen;
-	}
+	if (test_bit(FLG_TRANSPARENT, &bch->Flags) && reqlen >= bch->minlen)
+		len = reqlen;
+	else
+		len = bchannel_rxbuf_len(bch, bch->minlen, bch->maxlen);
+	bch->rx_skb = bchannel_rxpool_get(bch, len);
+	if (bch->rx_skb)
+		return skb_tailroom(bch->rx_skb);
+	/* pool empty or too small buffers */
 	bch->rx_skb = mI_alloc_skb(len, GFP_ATOMIC);
 	if (!bch->rx_skb) {
 		pr_warning("B%d receive no memory for %d bytes\n",
@@ -23,6 +23,8 @@
 
 static u_int *debug;
 
+static struct mISDN_cache l2_cache;
+
 static
 struct Fsm l2fsm = {NULL, 0, 0, NULL, NULL};
 
@@ -630,6 +632,11 @@ send_uframe(struct layer2 *l2, struct sk_buff *skb, u_char cmd, u_char cr)
 
 	i = sethdraddr(l2, tmp, cr);
 	tmp[i++] = cmd;
+	/* the monitor sockets may share the data of a received frame */
+	if (skb && skb_cloned(skb)) {
+		dev_kfree_skb(skb);
+		skb = NULL;
+	}
 	if (skb)
 		skb_trim(skb, 0);
 	else {
@@ -2085,7 +2092,7 @@ release_l2(struct layer2 *l2)
 			l2->ch.st->dev->D.ctrl(&l2->ch.st->dev->D,
 					       CLOSE_CHANNEL, NULL);
 	}
-	kfree(l2);
+	free_l2(l2);
 }
 
 static int
@@ -2116,6 +2123,24 @@ l2_ctrl(struct mISDNchannel *ch, u_int cmd, void *arg)
 	return 0;
 }
 
+void
+free_l2(struct layer2 *l2)
+{
+	mISDN_cache_free(&l2_cache, l2);
+}
+
+static void
+l2_ctor(void *obj)
+{
+	struct layer2 *l2 = obj;
+
+	memset(l2, 0, sizeof(*l2));
+	skb_queue_head_init(&l2->i_queue);
+	skb_queue_head_init(&l2->ui_queue);
+	skb_queue_head_init(&l2->down_queue);
+	skb_queue_head_init(&l2->tmp_queue);
+}
+
 struct layer2 *
 create_l2(struct mISDNchannel *ch, u_int protocol, u_long options, int tei,
 	  int sapi)
@@ -2123,9 +2148,9 @@ create_l2(struct mISDNchannel *ch, u_int protocol, u_long options, int tei,
 	struct layer2		*l2;
 	struct channel_req	rq;
 
-	l2 = kzalloc(sizeof(struct layer2), GFP_KERNEL);
+	l2 = mISDN_cache_alloc(&l2_cache, GFP_KERNEL);
 	if (!l2) {
-		printk(KERN_ERR "kzalloc layer2 failed\n");
+		printk(KERN_ERR "alloc layer2 failed\n");
 		return NULL;
 	}
 	l2->next_id = 1;
@@ -2198,13 +2223,9 @@ create_l2(struct mISDNchannel *ch, u_int protocol, u_long options, int tei,
 	default:
 		printk(KERN_ERR "layer2 create failed prt %x\n",
 		       protocol);
-		kfree(l2);
+		free_l2(l2);
 		return NULL;
 	}
-	skb_queue_head_init(&l2->i_queue);
-	skb_queue_head_init(&l2->ui_queue);
-	skb_queue_head_init(&l2->down_queue);
-	skb_queue_head_init(&l2->tmp_queue);
 	InitWin(l2);
 	l2->l2m.fsm = &l2fsm;
 	if (test_bit(FLG_LAPB, &l2->flag) ||
@@ -2249,6 +2270,10 @@ Isdnl2_Init(u_int *deb)
 {
 	int res;
 	debug = deb;
+	res = mISDN_cache_create(&l2_cache, "mISDN_layer2",
+				 sizeof(struct layer2), l2_ctor);
+	if (res)
+		return res;
 	mISDN_register_Bprotocol(&X75SLP);
 	l2fsm.state_count = L2_STATE_COUNT;
 	l2fsm.event_count = L2_EVENT_COUNT;
@@ -2266,6 +2291,7 @@ error_fsm:
 	mISDN_FsmFree(&l2fsm);
 error:
 	mISDN_unregister_Bprotocol(&X75SLP);
+	mISDN_cache_destroy(&l2_cache);
 	return res;
 }
 
@@ -2275,4 +2301,5 @@ Isdnl2_cleanup(void)
 	mISDN_unregister_Bprotocol(&X75SLP);
 	TEIFree();
 	mISDN_FsmFree(&l2fsm);
+	mISDN_cache_destroy(&l2_cache);
 }
@@ -91,6 +91,7 @@ enum {
 
 extern struct layer2	*create_l2(struct mISDNchannel *, u_int,
 				   u_long, int, int);
+extern void		free_l2(struct layer2 *);
 extern int		tei_l2(struct layer2 *, u_int, u_long arg);
 
 
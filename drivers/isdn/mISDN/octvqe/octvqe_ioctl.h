@@ -27,6 +27,7 @@ $Octasic_Revision: 4 $
 #ifndef __OCTVQE_IOCTL_H__
 #define __OCTVQE_IOCTL_H__
 
+#include <linux/types.h>
 
 /* Use 'o' as magic number */
 #define OCTDEV_IOCTL_MAGIC 'o'
@@ -43,4 +44,36 @@ $Octasic_Revision: 4 $
 #define OCTDEV_IOCTL_MAX_TIME_US _IOW(OCTDEV_IOCTL_MAGIC, 10, int)
 #define OCTDEV_IOCTL_MAXNR 10
 
+/* Samples of a buffer (20 ms) and buffers per direction of a channel. */
+#define OCTDEV_BUFFER_SIZE (8 * 20)
+#define OCTDEV_NUM_BUFFERS 2
+
+/*
+ * Shared memory transport, all channels through one device.
+ *
+ * mmap() the device with minor OCTDEV_SHM_MINOR to get a tOCTDEV_SHM.
+ * read() returns a __u64 bitmap of channels ready for processing: Rin
+ * and Sin are in buffer iXinReadBuf, Sout goes to buffer iSoutWriteBuf
+ * of the channel.  write() a __u64 bitmap of the processed channels.
+ */
+#define OCTDEV_SHM_MINOR 255
+#define OCTDEV_SHM_MAX_CHANNELS 64
+#define OCTDEV_SHM_VERSION 1
+
+typedef struct _OCTDEV_SHM_CHAN_ {
+	__s16 asRinSamples[OCTDEV_NUM_BUFFERS][OCTDEV_BUFFER_SIZE];
+	__s16 asSinSamples[OCTDEV_NUM_BUFFERS][OCTDEV_BUFFER_SIZE];
+	__s16 asSoutSamples[OCTDEV_NUM_BUFFERS][OCTDEV_BUFFER_SIZE];
+	__s32 iXinReadBuf;   /* valid while the channel is handed out */
+	__s32 iSoutWriteBuf;
+} tOCTDEV_SHM_CHAN, *tPOCTDEV_SHM_CHAN;
+
+typedef struct _OCTDEV_SHM_ {
+	__u32 ulVersion;
+	__u32 ulNumChannels;
+	__u32 ulBufferSize;
+	__u32 ulNumBuffers;
+	tOCTDEV_SHM_CHAN aChan[OCTDEV_SHM_MAX_CHANNELS];
+} tOCTDEV_SHM, *tPOCTDEV_SHM;
+
 #endif /* __OCTVQE_IOCTL_H__ */
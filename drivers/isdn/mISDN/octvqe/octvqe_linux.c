@@ -46,6 +46,8 @@ $Octasic_Revision: 21 $
 #include <linux/sched/signal.h>
 #include <linux/wait.h>
 #include <linux/mutex.h>
+#include <linux/vmalloc.h>
+#include <linux/mm.h>
 
 /* user<-> kernel space access functions */
 #include <asm/uaccess.h>
@@ -109,23 +111,29 @@ $Octasic_Revision: 21 $
 #define LINUX26
 #endif
 
-/* Maximum number of concurrent echo channels. */
-#define MAX_NUM_SUPPORTED_CHANNELS 8
+/* Maximum number of concurrent echo channels, one bit each in the shared memory bitmaps. */
+#define MAX_NUM_SUPPORTED_CHANNELS OCTDEV_SHM_MAX_CHANNELS
 
 #define DEV_NAME "octvqe"
 #define SUCCESS 0
 #define FAIL -1
 
-#define BUFFER_SIZE (8 * 20) /* 20 ms. */
-#define NUM_BUFFERS (2)
+#define BUFFER_SIZE OCTDEV_BUFFER_SIZE /* 20 ms. */
+#define NUM_BUFFERS OCTDEV_NUM_BUFFERS
+
+/* Values of fOpened. */
+#define OCTDEV_CLOSED 0
+#define OCTDEV_OPENED 1 /* Served through the channel device. */
+#define OCTDEV_SHM_OPENED 2 /* Served through the shared memory device. */
 
 typedef struct _OCTVQE_CHAN_INSTANCE_ {
     unsigned long           ulChannelIndex;
     void                    *pvZapEcChan; /* Reverse lookup to upper layer. */
 
-    short                   asRinSamples[NUM_BUFFERS][BUFFER_SIZE];
-    short                   asSinSamples[NUM_BUFFERS][BUFFER_SIZE];
-    short                   asSoutSamples[NUM_BUFFERS][BUFFER_SIZE];
+    /* Sample buffers, located in the shared memory area. */
+    short                   (*asRinSamples)[BUFFER_SIZE];
+    short                   (*asSinSamples)[BUFFER_SIZE];
+    short                   (*asSoutSamples)[BUFFER_SIZE];
     unsigned long           ulXinReadPtr;
     unsigned long           ulSoutReadPtr;
     unsigned long           ulXinWritePtr;
@@ -174,11 +182,25 @@ typedef struct _OCTVQE_CHAN_INSTANCE_ {
 
 } tOCTVQE_CHAN_INSTANCE, *tPOCTVQE_CHAN_INSTANCE;
 
+/* Handle given to the upper layer, no lookup is needed to find the channel. */
+typedef struct _OCTVQE_EC_HANDLE_ {
+    tPOCTVQE_CHAN_INSTANCE  pChan; /* NULL if no OCTVQE channel was available. */
+    void                    *pvDefaultEchoCanContext; /* Only used if pChan is NULL. */
+} tOCTVQE_EC_HANDLE, *tPOCTVQE_EC_HANDLE;
+
 tPOCTVQE_CHAN_INSTANCE g_apEchoChanInst[MAX_NUM_SUPPORTED_CHANNELS] = { 0 };
 
+/* Shared memory transport, see octvqe_ioctl.h. */
+static tOCTDEV_SHM *g_pShm;
+static int g_fShmOpened;
+static unsigned long long g_ullShmBusy; /* Channels handed out to user space. */
+static DEFINE_MUTEX(g_ShmMutex);
+static DECLARE_WAIT_QUEUE_HEAD(g_ShmWaitQueue);
+
 /* Exported symbols. */
 EXPORT_SYMBOL(ZapOctVqeApiEcChannelInitialize);
 EXPORT_SYMBOL(ZapOctVqeApiEcChannelProcess);
+EXPORT_SYMBOL(ZapOctVqeApiEcChannelProcessBlock);
 EXPORT_SYMBOL(ZapOctVqeApiEcChannelFree);
 EXPORT_SYMBOL(ZapOctVqeApiEcChannelTrainTap);
 
@@ -226,10 +248,18 @@ int octvqe_ratelimit(void)
 void *ZapOctVqeApiEcChannelInitialize(int f_iLen, int f_iAdaptionMode)
 {
     tPOCTVQE_CHAN_INSTANCE pChan = NULL;
+    tPOCTVQE_EC_HANDLE pHandle;
     int i;
     unsigned long ulFlags;
     void *pvDefaultEchoCanContext;
 
+    /* The handle given to the upper layer points directly at its channel. */
+    pHandle = kzalloc(sizeof(tOCTVQE_EC_HANDLE), GFP_ATOMIC);
+    if (pHandle == NULL) {
+	printk(KERN_WARNING "%s: Could not allocate echo canceller handle!\n", DEV_NAME);
+	return NULL;
+    }
+
     /* Check if we can open this channel. */
     for (i = 0; i < MAX_NUM_SUPPORTED_CHANNELS; i++) {
 		spin_lock_irqsave(&g_apEchoChanInst[i]->Lock, ulFlags);
@@ -246,11 +276,13 @@ void *ZapOctVqeApiEcChannelInitialize(int f_iLen, int f_iAdaptionMode)
 	pvDefaultEchoCanContext = echo_can_create(f_iLen, f_iAdaptionMode);
 	if (pvDefaultEchoCanContext == NULL) {
 	    printk(KERN_WARNING "%s: Could not create default echo canceller!\n", DEV_NAME);
+	    kfree(pHandle);
 	    return NULL;
 	}
 
 	/* printk(KERN_WARNING "%s: All channels (%d) opened!\n", DEV_NAME, MAX_NUM_SUPPORTED_CHANNELS); */
-	return pvDefaultEchoCanContext;
+	pHandle->pvDefaultEchoCanContext = pvDefaultEchoCanContext;
+	return pHandle;
     }
 
 	/* Set driver channel information. */
@@ -260,7 +292,9 @@ void *ZapOctVqeApiEcChannelInitialize(int f_iLen, int f_iAdaptionMode)
 
     pChan->pvDefaultEchoCanContext = echo_can_create(f_iLen, f_iAdaptionMode);
     if (pChan->pvDefaultEchoCanContext == NULL) {
+	spin_unlock_irqrestore(&pChan->Lock, ulFlags);
 	printk(KERN_WARNING "%s: Could not create default echo canceller!\n", DEV_NAME);
+	kfree(pHandle);
 	return NULL;
     }
 
@@ -268,7 +302,8 @@ void *ZapOctVqeApiEcChannelInitialize(int f_iLen, int f_iAdaptionMode)
 	pChan->ulReceivedSamples = 0;
 
 	/* Identify channel with upper layer. */
-	pChan->pvZapEcChan = pChan;
+	pChan->pvZapEcChan = pHandle;
+	pHandle->pChan = pChan;
 
     /* Remember the that this channel is used. */
     pChan->fUsed = 1;
@@ -294,18 +329,18 @@ void *ZapOctVqeApiEcChannelInitialize(int f_iLen, int f_iAdaptionMode)
 	spin_unlock_irqrestore(&pChan->Lock, ulFlags);
 
     /* Start with some silence on the ports. */
-    memset(pChan->asRinSamples, 0, sizeof(pChan->asRinSamples));
-	memset(pChan->asSinSamples, 0, sizeof(pChan->asSinSamples));
-	memset(pChan->asSoutSamples, 0, sizeof(pChan->asSoutSamples));
+    memset(pChan->asRinSamples, 0, NUM_BUFFERS * BUFFER_SIZE * sizeof(short));
+	memset(pChan->asSinSamples, 0, NUM_BUFFERS * BUFFER_SIZE * sizeof(short));
+	memset(pChan->asSoutSamples, 0, NUM_BUFFERS * BUFFER_SIZE * sizeof(short));
 
-    return pChan;
+    return pHandle;
 }
 
 void ZapOctVqeApiEcChannelFree(void *f_pvEcChan)
 {
-    int i;
     unsigned long ulFlags;
-    tPOCTVQE_CHAN_INSTANCE pChan = NULL;
+    tPOCTVQE_EC_HANDLE pHandle = (tPOCTVQE_EC_HANDLE)f_pvEcChan;
+    tPOCTVQE_CHAN_INSTANCE pChan;
     void *pvDefaultEchoCanContext = NULL;
 
 	if (f_pvEcChan == NULL) {
@@ -313,27 +348,17 @@ void ZapOctVqeApiEcChannelFree(void *f_pvEcChan)
 	return;
 	}
 
-	/* Find the channel to be freed in our instance list. */
-    for (i = 0; i < MAX_NUM_SUPPORTED_CHANNELS; i++) {
-		spin_lock_irqsave(&g_apEchoChanInst[i]->Lock, ulFlags);
-
-	if (g_apEchoChanInst[i]->pvZapEcChan == f_pvEcChan) {
-	    pChan = g_apEchoChanInst[i];
-	    break;
-	}
-
-		spin_unlock_irqrestore(&g_apEchoChanInst[i]->Lock, ulFlags);
-    }
-
-	/* Check if we found the channel to be freed. */
+	/* Check if the handle has a channel to be freed. */
+    pChan = pHandle->pChan;
     if (pChan == NULL) {
-		/* It must probably be the default echo canceller.  Free it. */
-		echo_can_free(f_pvEcChan);
-
-	/* printk(KERN_ERR "%s: Trying to close an invalid channel!\n", DEV_NAME); */
+		/* It is the default echo canceller.  Free it. */
+		echo_can_free(pHandle->pvDefaultEchoCanContext);
+		kfree(pHandle);
 	return;
     }
 
+    spin_lock_irqsave(&pChan->Lock, ulFlags);
+
     /* Close this channel. */
     pChan->pvZapEcChan = NULL;
     pChan->fChanOk = 0;
@@ -349,35 +374,30 @@ void ZapOctVqeApiEcChannelFree(void *f_pvEcChan)
     if (pvDefaultEchoCanContext != NULL)
 	echo_can_free(pvDefaultEchoCanContext);
 
+    kfree(pHandle);
+
 	/* We're done here. */
 }
 
 int ZapOctVqeApiEcChannelTrainTap(void *f_pvEcChan, int f_iPos, short f_sVal)
 {
-    int                    i;
-    tPOCTVQE_CHAN_INSTANCE pChan = NULL;
+    tPOCTVQE_EC_HANDLE pHandle = (tPOCTVQE_EC_HANDLE)f_pvEcChan;
+    tPOCTVQE_CHAN_INSTANCE pChan;
 
     if (f_pvEcChan == NULL) {
 	printk(KERN_ERR "%s: Cannot train NULL channel!\n", DEV_NAME);
 	return 1;
     }
 
-    /* Find the given channel.  No need to SpinLock here since we will not modify the pointer. */
-    for (i = 0; i < MAX_NUM_SUPPORTED_CHANNELS; i++) {
-	if (g_apEchoChanInst[i]->pvZapEcChan == f_pvEcChan) {
-	    pChan = g_apEchoChanInst[i];
-	    break;
-	}
-    }
-
     /* Check if it is one of our channels. */
+    pChan = pHandle->pChan;
     if (pChan == NULL) {
 	/* Call the default echo canceller training method. */
-	return echo_can_traintap(f_pvEcChan, f_iPos, f_sVal);
+	return echo_can_traintap(pHandle->pvDefaultEchoCanContext, f_iPos, f_sVal);
     }
 
     /* Check if the OCTVQE service is listening on this channel. */
-    if (pChan->fOpened != 1) {
+    if (pChan->fOpened == OCTDEV_CLOSED) {
 	/* Fallback to the default echo canceller training method. */
 	return echo_can_traintap(pChan->pvDefaultEchoCanContext, f_iPos, f_sVal);
     }
@@ -386,139 +406,113 @@ int ZapOctVqeApiEcChannelTrainTap(void *f_pvEcChan, int f_iPos, short f_sVal)
     return 1;
 }
 
-short ZapOctVqeApiEcChannelProcess(void *f_pvEcChan, short f_sRin, short f_sSin)
+/* Process a frame of Rin/Sin samples, Sout may be the same buffer as Sin. */
+/* The buffers of the channel are updated in runs under one lock. */
+void ZapOctVqeApiEcChannelProcessBlock(void *f_pvEcChan, const short *f_psRin,
+	const short *f_psSin, short *f_psSout, int f_iLen)
 {
-    int                    i;
+	int                    iPos;
+	int                    iRun;
 	int                    iOldXinWriteBuf;
 	int                    iOldSoutReadBuf;
 	int                    fXinOverflow = 0;
 	int                    fSoutUnderflow = 0;
 	int                    fWakeUpReader = 0;
 	int                    fWakeUpWrite = 0;
-	short                  sSout = 0; /* compiler warning fix by Jolly */
 	unsigned long          ulFlags;
-    tPOCTVQE_CHAN_INSTANCE pChan = NULL;
+    tPOCTVQE_EC_HANDLE     pHandle = (tPOCTVQE_EC_HANDLE)f_pvEcChan;
+    tPOCTVQE_CHAN_INSTANCE pChan;
 
 	if (f_pvEcChan == NULL) {
 	printk(KERN_ERR "%s: Cannot process NULL channel!\n", DEV_NAME);
-	return f_sSin;
-	}
-
-	/* Find the given channel.  No need to SpinLock here since we will not modify the pointer. */
-    for (i = 0; i < MAX_NUM_SUPPORTED_CHANNELS; i++) {
-	if (g_apEchoChanInst[i]->pvZapEcChan == f_pvEcChan) {
-	    pChan = g_apEchoChanInst[i];
-	    break;
+	memmove(f_psSout, f_psSin, f_iLen * sizeof(short));
+	return;
 	}
-    }
 
 	/* Check if it is one of our channels.  Otherwise fallback to the Zaptel echo canceller. */
+    pChan = pHandle->pChan;
     if (pChan == NULL) {
-	return echo_can_update(f_pvEcChan, f_sRin, f_sSin);
+	echo_can_update_block(pHandle->pvDefaultEchoCanContext, f_psRin, f_psSin, f_psSout, f_iLen);
+	return;
     }
 
 	/* Check if the user thread is listening on this channel. */
-	if (pChan->fOpened != 1) {
+	if (pChan->fOpened == OCTDEV_CLOSED) {
 		if (pChan->fChanPrintErr == 0) {
-			printk(KERN_WARNING "%s: OCTVQE service deactivated on zaptel channel #%d!\n", DEV_NAME, i+1);
+			printk(KERN_WARNING "%s: OCTVQE service deactivated on zaptel channel #%lu!\n", DEV_NAME, pChan->ulChannelIndex+1);
 			pChan->fChanPrintErr = 1;
 		}
 
 	/* Call the DEFAULT echo canceller process function, if available. */
 	if (pChan->pvDefaultEchoCanContext != NULL) {
-	    return echo_can_update(pChan->pvDefaultEchoCanContext, f_sRin, f_sSin);
+	    echo_can_update_block(pChan->pvDefaultEchoCanContext, f_psRin, f_psSin, f_psSout, f_iLen);
 	} else {
 	    /* Cannot "echo cancel" this. */
-	    return f_sSin;
+	    memmove(f_psSout, f_psSin, f_iLen * sizeof(short));
 	}
+	return;
 	}
 
 	pChan->fChanPrintErr = 0;
 
-    if (pChan->fChanOk) {
-		spin_lock_irqsave(&pChan->Lock, ulFlags);
+    if (pChan->fChanOk == 0) {
+	/* If something is wrong with the echo canceller, return Sin. */
+	memmove(f_psSout, f_psSin, f_iLen * sizeof(short));
+	return;
+    }
 
-		/* If space to receive samples. */
-		if (pChan->iXinWriteBuf > -1) {
-			/* Accumulate samples until enough for processing. */
-			pChan->asRinSamples[pChan->iXinWriteBuf][pChan->ulXinWritePtr] = f_sRin;
-			pChan->asSinSamples[pChan->iXinWriteBuf][pChan->ulXinWritePtr] = f_sSin;
-			pChan->ulXinWritePtr++;
-			if (pChan->ulXinWritePtr == BUFFER_SIZE) {
-				iOldXinWriteBuf = pChan->iXinWriteBuf;
-				pChan->iXinWriteBuf = (pChan->iXinWriteBuf + 1) % NUM_BUFFERS;
-
-				/* Reset write index. */
-				pChan->ulXinWritePtr = 0;
-
-				/* Check if about to overflow. */
-				if (pChan->iXinWriteBuf == pChan->iXinReadBuf) {
-					/* Whoops, we're full, and have no where else
-					to store into for the next samples.  We'll drop stuff
-					until there's a buffer available */
-
-					pChan->iXinWriteBuf = -1;
-				}
-
-				/* Check if just started receiving. */
-				if (pChan->iXinReadBuf < 0) {
-					/* Start out buffer if not already */
-					pChan->iXinReadBuf = iOldXinWriteBuf;
-				}
-
-				/* Notify a blocked reader that there is data available
-				to be read, unless we're waiting for it to be full */
-				/*printk("Notifying reader data in buf %d\n", iOldXinWriteBuf); */
-				fWakeUpReader = 1;
-			}
-		} else {
+	spin_lock_irqsave(&pChan->Lock, ulFlags);
+
+	/* Accumulate samples until enough for processing. */
+	for (iPos = 0; iPos < f_iLen; iPos += iRun) {
+		/* If no space to receive samples, the rest is dropped. */
+		if (pChan->iXinWriteBuf < 0) {
 			/* No more space to put the samples in! */
 			fXinOverflow = 1;
 
 			/* Let the user know! */
 			fWakeUpReader = 1;
+			break;
 		}
 
-		/* If Sout buffer contains results. */
-		if (pChan->iSoutReadBuf > -1) {
-			/* We have at least received something from the OCTVQE service. */
-			pChan->fChanReady = 1;
-
-			/* Read in pending Sout sample. */
-			sSout = pChan->asSoutSamples[pChan->iSoutReadBuf][pChan->ulSoutReadPtr];
-
-			/* --- Check buffer status. */
-
-			/* Increment Sout read pointer to remember this sample has been read. */
-			pChan->ulSoutReadPtr++;
-			if (pChan->ulSoutReadPtr == BUFFER_SIZE) {
-				/* We've reached the end of our buffer.  Go to the next. */
-
-				iOldSoutReadBuf = pChan->iSoutReadBuf;
-				pChan->iSoutReadBuf = (pChan->iSoutReadBuf + 1) % NUM_BUFFERS;
-
-				/* Reset read index. */
-				pChan->ulSoutReadPtr = 0;
-
-				/* Check if about to underflow. */
-				if (pChan->iSoutReadBuf == pChan->iSoutWriteBuf) {
-					/* Whoops, we ran out of buffers.  Mark ours
-					as -1 and wait for the filler to notify us that there
-					is something to write */
+		iRun = BUFFER_SIZE - pChan->ulXinWritePtr;
+		if (iRun > f_iLen - iPos)
+			iRun = f_iLen - iPos;
+		memcpy(&pChan->asRinSamples[pChan->iXinWriteBuf][pChan->ulXinWritePtr], &f_psRin[iPos], iRun * sizeof(short));
+		memcpy(&pChan->asSinSamples[pChan->iXinWriteBuf][pChan->ulXinWritePtr], &f_psSin[iPos], iRun * sizeof(short));
+		pChan->ulXinWritePtr += iRun;
+		if (pChan->ulXinWritePtr == BUFFER_SIZE) {
+			iOldXinWriteBuf = pChan->iXinWriteBuf;
+			pChan->iXinWriteBuf = (pChan->iXinWriteBuf + 1) % NUM_BUFFERS;
+
+			/* Reset write index. */
+			pChan->ulXinWritePtr = 0;
+
+			/* Check if about to overflow. */
+			if (pChan->iXinWriteBuf == pChan->iXinReadBuf) {
+				/* Whoops, we're full, and have no where else
+				to store into for the next samples.  We'll drop stuff
+				until there's a buffer available */
+
+				pChan->iXinWriteBuf = -1;
+			}
 
-					pChan->iSoutReadBuf = -1;
-				}
+			/* Check if just started receiving. */
+			if (pChan->iXinReadBuf < 0) {
+				/* Start out buffer if not already */
+				pChan->iXinReadBuf = iOldXinWriteBuf;
+			}
 
-				/* Check if have just freed enough memory for the writer to wake up. */
-				if (pChan->iSoutWriteBuf < 0) {
-					/* Start out buffer if not already */
-					pChan->iSoutWriteBuf = iOldSoutReadBuf;
-				}
+			/* Notify a blocked reader that there is data available
+			to be read, unless we're waiting for it to be full */
+			fWakeUpReader = 1;
+		}
+	}
 
-				/* Wake up the write thread, in case it is sleeping! */
-				fWakeUpWrite = 1;
-			}
-		} else {
+	/* Read in pending Sout samples.  Sin is not needed anymore. */
+	for (iPos = 0; iPos < f_iLen; iPos += iRun) {
+		/* If Sout buffer contains no results. */
+		if (pChan->iSoutReadBuf < 0) {
 			/* Running out of samples on the Sout side! */
 			/* The user thread is probably choking.. */
 
@@ -530,52 +524,366 @@ short ZapOctVqeApiEcChannelProcess(void *f_pvEcChan, short f_sRin, short f_sSin)
 			fWakeUpWrite = 1;
 
 			/* Send Silence  */
-			sSout = 0; /* f_sSin; */
+			memset(&f_psSout[iPos], 0, (f_iLen - iPos) * sizeof(short));
+			break;
 		}
 
-		spin_unlock_irqrestore(&pChan->Lock, ulFlags);
+		/* We have at least received something from the OCTVQE service. */
+		pChan->fChanReady = 1;
 
-		/* Wake up any waiting process -- If needed. */
-		if (fWakeUpReader == 1) /* wake_up_interruptible waiting on read */ {
-			wake_up_interruptible(&pChan->ReadWaitQueue);
+		iRun = BUFFER_SIZE - pChan->ulSoutReadPtr;
+		if (iRun > f_iLen - iPos)
+			iRun = f_iLen - iPos;
+		memcpy(&f_psSout[iPos], &pChan->asSoutSamples[pChan->iSoutReadBuf][pChan->ulSoutReadPtr], iRun * sizeof(short));
 
-			/* Retrieve CPU time before processing. */
-			pChan->ulTimestampIn = (unsigned long)rdtsc();
-		}
+		/* --- Check buffer status. */
+
+		/* Increment Sout read pointer to remember these samples have been read. */
+		pChan->ulSoutReadPtr += iRun;
+		if (pChan->ulSoutReadPtr == BUFFER_SIZE) {
+			/* We've reached the end of our buffer.  Go to the next. */
+
+			iOldSoutReadBuf = pChan->iSoutReadBuf;
+			pChan->iSoutReadBuf = (pChan->iSoutReadBuf + 1) % NUM_BUFFERS;
 
-		if (fWakeUpWrite == 1) /* wake_up_interruptible waiting on write */
-			wake_up_interruptible(&pChan->WriteWaitQueue);
+			/* Reset read index. */
+			pChan->ulSoutReadPtr = 0;
 
-		if ((fWakeUpReader == 1) || (fWakeUpWrite == 1)) /* wake_up_interruptible waiting on select */
-			wake_up_interruptible(&pChan->SelectWaitQueue);
+			/* Check if about to underflow. */
+			if (pChan->iSoutReadBuf == pChan->iSoutWriteBuf) {
+				/* Whoops, we ran out of buffers.  Mark ours
+				as -1 and wait for the filler to notify us that there
+				is something to write */
 
-		/* Check if we are about to run out of sout samples. */
-		if (fXinOverflow == 1) {
-			/* Buffer overrun!  The host needs to wake up! */
-			if (verbose == 1) {
-				if (octvqe_ratelimit() == 0)
-					printk(KERN_WARNING "%s: Xin buffer overrun on channel #%d\n", DEV_NAME, i+1);
+				pChan->iSoutReadBuf = -1;
 			}
-		}
 
-		if (fSoutUnderflow == 1) {
-			/* Buffer underrun!  We really need some samples! */
-			if (verbose == 1) {
-				if (octvqe_ratelimit() == 0)
-					printk(KERN_WARNING "%s: Sout buffer underrun on channel #%d\n", DEV_NAME, i+1);
+			/* Check if have just freed enough memory for the writer to wake up. */
+			if (pChan->iSoutWriteBuf < 0) {
+				/* Start out buffer if not already */
+				pChan->iSoutWriteBuf = iOldSoutReadBuf;
 			}
+
+			/* Wake up the write thread, in case it is sleeping! */
+			fWakeUpWrite = 1;
 		}
-		pChan->ulReceivedSamples++;
 	}
 
-    if (pChan->fChanOk == 0) {
-	/* If something is wrong with the echo canceller, return Sin. */
-	sSout = f_sSin;
-    }
+	spin_unlock_irqrestore(&pChan->Lock, ulFlags);
+
+	/* Wake up any waiting process -- If needed. */
+	if (fWakeUpReader == 1) /* wake_up_interruptible waiting on read */ {
+		wake_up_interruptible(&pChan->ReadWaitQueue);
+
+		/* Retrieve CPU time before processing. */
+		pChan->ulTimestampIn = (unsigned long)rdtsc();
+	}
+
+	if (fWakeUpWrite == 1) /* wake_up_interruptible waiting on write */
+		wake_up_interruptible(&pChan->WriteWaitQueue);
+
+	if ((fWakeUpReader == 1) || (fWakeUpWrite == 1)) { /* wake_up_interruptible waiting on select */
+		wake_up_interruptible(&pChan->SelectWaitQueue);
+
+		/* The shared memory reader waits for all of its channels. */
+		if (pChan->fOpened == OCTDEV_SHM_OPENED)
+			wake_up_interruptible(&g_ShmWaitQueue);
+	}
+
+	/* Check if we are about to run out of sout samples. */
+	if (fXinOverflow == 1) {
+		/* Buffer overrun!  The host needs to wake up! */
+		if (verbose == 1) {
+			if (octvqe_ratelimit() == 0)
+				printk(KERN_WARNING "%s: Xin buffer overrun on channel #%lu\n", DEV_NAME, pChan->ulChannelIndex+1);
+		}
+	}
+
+	if (fSoutUnderflow == 1) {
+		/* Buffer underrun!  We really need some samples! */
+		if (verbose == 1) {
+			if (octvqe_ratelimit() == 0)
+				printk(KERN_WARNING "%s: Sout buffer underrun on channel #%lu\n", DEV_NAME, pChan->ulChannelIndex+1);
+		}
+	}
+	pChan->ulReceivedSamples += f_iLen;
+}
+
+short ZapOctVqeApiEcChannelProcess(void *f_pvEcChan, short f_sRin, short f_sSin)
+{
+	short sSout;
+
+	ZapOctVqeApiEcChannelProcessBlock(f_pvEcChan, &f_sRin, &f_sSin, &sSout, 1);
 
     return sSout;
 }
 
+/* Release the Xin buffer read by user space.  Called with the channel lock held. */
+static void octdev_xin_release(tPOCTVQE_CHAN_INSTANCE pChan)
+{
+	int iOldXinReadBuf;
+
+	iOldXinReadBuf = pChan->iXinReadBuf;
+	pChan->iXinReadBuf = (pChan->iXinReadBuf + 1) % NUM_BUFFERS;
+
+	/* Check if we read everything, most probably.  */
+	if (pChan->iXinReadBuf == pChan->iXinWriteBuf) {
+		/* Out of stuff for now, let the interrupt guy know. */
+		pChan->iXinReadBuf = -1;
+	}
+
+	/* Check if our Xin buffers were full. */
+	if (pChan->iXinWriteBuf < 0) {
+		/* A buffer is cleared for the interrupt, ready to be filled!!! */
+		pChan->iXinWriteBuf = iOldXinReadBuf;
+	}
+}
+
+/* Queue the Sout buffer written by user space.  Called with the channel lock held. */
+/* Returns 1 if the Sout buffers are full now. */
+static int octdev_sout_queue(tPOCTVQE_CHAN_INSTANCE pChan, int iSoutWriteBuf)
+{
+	int fSoutBufferOverflow = 0;
+
+    /* Be extra careful with the locks and the variables we touch. */
+	pChan->iSoutWriteBuf = (iSoutWriteBuf + 1) % NUM_BUFFERS;
+
+	/* Check if about to overflow. */
+	if (pChan->iSoutWriteBuf == pChan->iSoutReadBuf) {
+		/* Whoops, we're full, and have no space left
+		to store into for the next buffer.  We'll have to wait
+		until there's a buffer available, the next time we are called. */
+
+		pChan->iSoutWriteBuf = -1;
+
+		fSoutBufferOverflow = 1;
+	}
+
+	/* Check if just started receiving. */
+	if (pChan->iSoutReadBuf < 0) {
+		/* Start out buffer if not already */
+		pChan->iSoutReadBuf = iSoutWriteBuf;
+	}
+
+	return fSoutBufferOverflow;
+}
+
+/*
+ * Shared memory transport.
+ *
+ * The sample buffers of all channels are located in one area, which the
+ * OCTVQE service maps with mmap() on the OCTDEV_SHM_MINOR device.  A read()
+ * blocks until channels have a full Xin buffer and room for Sout, and
+ * returns the bitmap of these channels.  The buffers to use are found in
+ * the channel headers of the area.  A write() of a bitmap returns the
+ * processed channels to the kernel.  So all channels are served with two
+ * system calls per buffer period, and no samples are copied.
+ */
+
+/* Collect the ready channels, which are not handed out yet.  Called with g_ShmMutex held, */
+/* only the wait condition of read() checks without it, which is just a hint. */
+static unsigned long long octdev_shm_collect(int f_fHandOut)
+{
+    unsigned long long ullReady = 0;
+    tPOCTVQE_CHAN_INSTANCE pChan;
+    unsigned long ulFlags;
+    int i;
+
+    for (i = 0; i < MAX_NUM_SUPPORTED_CHANNELS; i++) {
+	if (g_ullShmBusy & (1ULL << i))
+	    continue;
+
+	pChan = g_apEchoChanInst[i];
+	spin_lock_irqsave(&pChan->Lock, ulFlags);
+
+	if (pChan->fOpened == OCTDEV_SHM_OPENED &&
+	    pChan->iXinReadBuf > -1 && pChan->iSoutWriteBuf > -1) {
+		ullReady |= 1ULL << i;
+
+		/* Tell user space which buffers to use. */
+		if (f_fHandOut) {
+			g_pShm->aChan[i].iXinReadBuf = pChan->iXinReadBuf;
+			g_pShm->aChan[i].iSoutWriteBuf = pChan->iSoutWriteBuf;
+		}
+	}
+
+	spin_unlock_irqrestore(&pChan->Lock, ulFlags);
+    }
+
+    if (f_fHandOut)
+	g_ullShmBusy |= ullReady;
+
+    return ullReady;
+}
+
+static int octdev_shm_release(struct inode *inode, struct file *file)
+{
+    tPOCTVQE_CHAN_INSTANCE pChan;
+    unsigned long ulFlags;
+    int i;
+
+    mutex_lock(&g_ShmMutex);
+
+    /* The channels fall back to the default echo canceller. */
+    for (i = 0; i < MAX_NUM_SUPPORTED_CHANNELS; i++) {
+	pChan = g_apEchoChanInst[i];
+	spin_lock_irqsave(&pChan->Lock, ulFlags);
+	if (pChan->fOpened == OCTDEV_SHM_OPENED)
+		pChan->fOpened = OCTDEV_CLOSED;
+	spin_unlock_irqrestore(&pChan->Lock, ulFlags);
+    }
+
+    g_ullShmBusy = 0;
+    g_fShmOpened = 0;
+
+    mutex_unlock(&g_ShmMutex);
+
+    module_put(THIS_MODULE);
+
+    return SUCCESS;
+}
+
+static ssize_t octdev_shm_read(struct file *filp, char *f_pUserBuf,
+		       size_t f_Length, loff_t *offset)
+{
+    unsigned long long ullReady;
+
+    if (f_Length < sizeof(ullReady))
+	return -EINVAL;
+
+    /* Sleep until some channels are ready, unless non-blocking. */
+    for (;;) {
+	mutex_lock(&g_ShmMutex);
+	ullReady = octdev_shm_collect(1);
+	mutex_unlock(&g_ShmMutex);
+
+	if (ullReady != 0)
+		break;
+
+	if (filp->f_flags & O_NONBLOCK)
+		return -EAGAIN;
+
+	if (wait_event_interruptible(g_ShmWaitQueue, octdev_shm_collect(0) != 0))
+		return -ERESTARTSYS;
+    }
+
+    if (copy_to_user(f_pUserBuf, &ullReady, sizeof(ullReady)))
+	return -EFAULT;
+
+    return sizeof(ullReady);
+}
+
+static ssize_t octdev_shm_write(struct file *filp, const char *f_pUserBuf,
+		       size_t f_Length, loff_t *offset)
+{
+    unsigned long long ullDone;
+    tPOCTVQE_CHAN_INSTANCE pChan;
+    tPOCTDEV_SHM_CHAN pShmChan;
+    unsigned long ulFlags;
+    int i;
+
+    if (f_Length != sizeof(ullDone))
+	return -EINVAL;
+
+    if (copy_from_user(&ullDone, f_pUserBuf, sizeof(ullDone)))
+	return -EFAULT;
+
+    mutex_lock(&g_ShmMutex);
+
+    /* Only channels handed out by read() can be returned. */
+    ullDone &= g_ullShmBusy;
+    g_ullShmBusy &= ~ullDone;
+
+    for (i = 0; i < MAX_NUM_SUPPORTED_CHANNELS; i++) {
+	if (!(ullDone & (1ULL << i)))
+	    continue;
+
+	pChan = g_apEchoChanInst[i];
+	pShmChan = &g_pShm->aChan[i];
+	spin_lock_irqsave(&pChan->Lock, ulFlags);
+
+	/* Skip the channel if it was reopened meanwhile. */
+	if (pChan->fOpened == OCTDEV_SHM_OPENED &&
+	    pChan->iXinReadBuf == pShmChan->iXinReadBuf &&
+	    pChan->iSoutWriteBuf == pShmChan->iSoutWriteBuf) {
+		octdev_xin_release(pChan);
+		/* Use the kernel copy, user space may change the area any time. */
+		octdev_sout_queue(pChan, pChan->iSoutWriteBuf);
+		pChan->ulProcessedBuf++;
+	}
+
+	spin_unlock_irqrestore(&pChan->Lock, ulFlags);
+    }
+
+    mutex_unlock(&g_ShmMutex);
+
+    return sizeof(ullDone);
+}
+
+static unsigned int octdev_shm_poll(struct file *filp,
+		       struct poll_table_struct *f_pPollStruct)
+{
+    unsigned int iMask = 0;
+
+    poll_wait(filp, &g_ShmWaitQueue, f_pPollStruct);
+
+    mutex_lock(&g_ShmMutex);
+    if (octdev_shm_collect(0) != 0)
+	iMask |= POLLIN | POLLRDNORM; /* readable */
+    mutex_unlock(&g_ShmMutex);
+
+    return iMask;
+}
+
+static int octdev_shm_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+    return remap_vmalloc_range(vma, g_pShm, vma->vm_pgoff);
+}
+
+static const struct file_operations octdev_shm_fops = {
+	.owner		= THIS_MODULE,
+	.read		= octdev_shm_read,
+	.write		= octdev_shm_write,
+	.release	= octdev_shm_release,
+	.poll		= octdev_shm_poll,
+	.mmap		= octdev_shm_mmap,
+};
+
+static int octdev_shm_open(struct inode *inode, struct file *file)
+{
+    tPOCTVQE_CHAN_INSTANCE pChan;
+    unsigned long ulFlags;
+    int i;
+
+    mutex_lock(&g_ShmMutex);
+
+    if (g_fShmOpened) {
+	mutex_unlock(&g_ShmMutex);
+	printk(KERN_WARNING "%s: Shared memory device is already opened\n", DEV_NAME);
+	return -EBUSY;
+    }
+
+    try_module_get(THIS_MODULE);
+
+    /* Serve all channels, which are not opened on their own device. */
+    for (i = 0; i < MAX_NUM_SUPPORTED_CHANNELS; i++) {
+	pChan = g_apEchoChanInst[i];
+	spin_lock_irqsave(&pChan->Lock, ulFlags);
+	if (pChan->fOpened == OCTDEV_CLOSED)
+		pChan->fOpened = OCTDEV_SHM_OPENED;
+	spin_unlock_irqrestore(&pChan->Lock, ulFlags);
+    }
+
+    g_ullShmBusy = 0;
+    g_fShmOpened = 1;
+
+    mutex_unlock(&g_ShmMutex);
+
+    file->f_op = &octdev_shm_fops;
+
+    return SUCCESS;
+}
+
 static int octdev_open(struct inode *inode, struct file *file)
 {
     unsigned int iMinor;
@@ -588,6 +896,10 @@ static int octdev_open(struct inode *inode, struct file *file)
 	iMinor = MINOR(inode->i_rdev);
 #endif /* LINUX26 */
 
+    /* All channels at once through the shared memory? */
+    if (iMinor == OCTDEV_SHM_MINOR)
+	return octdev_shm_open(inode, file);
+
     /* Check if we support that many channels. */
     if (iMinor >= MAX_NUM_SUPPORTED_CHANNELS) {
 	printk(KERN_WARNING "%s: Cannot open channel #%d, only %d channels supported\n", DEV_NAME, iMinor+1, MAX_NUM_SUPPORTED_CHANNELS);
@@ -595,7 +907,7 @@ static int octdev_open(struct inode *inode, struct file *file)
     }
 
     /* Check if the channel is already opened. */
-    if (g_apEchoChanInst[iMinor]->fOpened != 0) {
+    if (g_apEchoChanInst[iMinor]->fOpened != OCTDEV_CLOSED) {
 	printk(KERN_WARNING "%s: Echo cancellation channel #%d is already opened\n", DEV_NAME, iMinor+1);
 	return -EINVAL;
     }
@@ -613,7 +925,7 @@ static int octdev_open(struct inode *inode, struct file *file)
 	spin_lock_irqsave(&g_apEchoChanInst[iMinor]->Lock, ulFlags);
 
 	/* Remember that this channel is opened. */
-	g_apEchoChanInst[iMinor]->fOpened = 1;
+	g_apEchoChanInst[iMinor]->fOpened = OCTDEV_OPENED;
 
 	spin_unlock_irqrestore(&g_apEchoChanInst[iMinor]->Lock, ulFlags);
 
@@ -646,12 +958,14 @@ static int octdev_release(struct inode *inode, struct file *file)
 	return -EINVAL;
     }
 
+	mutex_lock(&g_ShmMutex);
 	spin_lock_irqsave(&g_apEchoChanInst[iMinor]->Lock, ulFlags);
 
-    /* Reset read index pointer. */
-    g_apEchoChanInst[iMinor]->fOpened = 0;
+    /* Reset read index pointer.  The shared memory device serves the channel from now on, if opened. */
+    g_apEchoChanInst[iMinor]->fOpened = g_fShmOpened ? OCTDEV_SHM_OPENED : OCTDEV_CLOSED;
 
 	spin_unlock_irqrestore(&g_apEchoChanInst[iMinor]->Lock, ulFlags);
+	mutex_unlock(&g_ShmMutex);
 
     return SUCCESS;
 }
@@ -668,7 +982,6 @@ static ssize_t octdev_read(
     /* Number of bytes actually written to the buffer */
     int iBytesRead = 0;
 	int iXinReadBuf;
-	int iOldXinReadBuf;
     unsigned long ulRc = 0;
     tPOCTVQE_CHAN_INSTANCE pChan;
     unsigned long ulFlags;
@@ -757,20 +1070,7 @@ static ssize_t octdev_read(
 	/* Update pointers. */
 	spin_lock_irqsave(&pChan->Lock, ulFlags);
 
-	iOldXinReadBuf = pChan->iXinReadBuf;
-	pChan->iXinReadBuf = (pChan->iXinReadBuf + 1) % NUM_BUFFERS;
-
-	/* Check if we read everything, most probably.  */
-	if (pChan->iXinReadBuf == pChan->iXinWriteBuf) {
-		/* Out of stuff for now, let the interrupt guy know. */
-		pChan->iXinReadBuf = -1;
-	}
-
-	/* Check if our Xin buffers were full. */
-	if (pChan->iXinWriteBuf < 0) {
-		/* A buffer is cleared for the interrupt, ready to be filled!!! */
-		pChan->iXinWriteBuf = iOldXinReadBuf;
-	}
+	octdev_xin_release(pChan);
 
     spin_unlock_irqrestore(&pChan->Lock, ulFlags);
 
@@ -793,7 +1093,6 @@ static ssize_t octdev_write(
     /* Number of bytes actually written to the buffer */
     int iBytesWritten = 0;
 	int iSoutWriteBuf;
-	int iOldSoutWriteBuf;
     unsigned long ulRc = 0;
     unsigned long ulFlags;
 	int fSoutBufferOverflow = 0;
@@ -870,30 +1169,11 @@ static ssize_t octdev_write(
 	if (ulRc == 0)
 		iBytesWritten += BUFFER_SIZE * 2;
 
-	iOldSoutWriteBuf = iSoutWriteBuf;
 	pChan->ulProcessedBuf++;
 
 	spin_lock_irqsave(&pChan->Lock, ulFlags);
 
-    /* Be extra careful with the locks and the variables we touch. */
-	pChan->iSoutWriteBuf = (iSoutWriteBuf + 1) % NUM_BUFFERS;
-
-	/* Check if about to overflow. */
-	if (pChan->iSoutWriteBuf == pChan->iSoutReadBuf) {
-		/* Whoops, we're full, and have no space left
-		to store into for the next buffer.  We'll have to wait
-		until there's a buffer available, the next time we are called. */
-
-		pChan->iSoutWriteBuf = -1;
-
-		fSoutBufferOverflow = 1;
-	}
-
-	/* Check if just started receiving. */
-	if (pChan->iSoutReadBuf < 0) {
-		/* Start out buffer if not already */
-		pChan->iSoutReadBuf = iOldSoutWriteBuf;
-	}
+	fSoutBufferOverflow = octdev_sout_queue(pChan, iSoutWriteBuf);
 
     spin_unlock_irqrestore(&pChan->Lock, ulFlags);
 
@@ -1130,6 +1410,18 @@ static int octvqe_init(void)
 	return iMajor;
     }
 
+    /* The sample buffers of all channels, shared with user space. */
+    g_pShm = vmalloc_user(sizeof(tOCTDEV_SHM));
+    if (g_pShm == NULL) {
+	printk(KERN_ERR "Allocating %d bytes of shared memory for dev %s failed\n", (int)sizeof(tOCTDEV_SHM), DEV_NAME);
+	unregister_chrdev(iMajor, DEV_NAME);
+	return -ENOMEM;
+    }
+    g_pShm->ulVersion = OCTDEV_SHM_VERSION;
+    g_pShm->ulNumChannels = MAX_NUM_SUPPORTED_CHANNELS;
+    g_pShm->ulBufferSize = BUFFER_SIZE;
+    g_pShm->ulNumBuffers = NUM_BUFFERS;
+
     /* The instance size is the basic structure size, plus the size of the diagnostic buffer, if requested. */
     iInstanceSize = sizeof(tOCTVQE_CHAN_INSTANCE);
 
@@ -1154,6 +1446,9 @@ static int octvqe_init(void)
 	    }
 	}
 
+	vfree(g_pShm);
+	g_pShm = NULL;
+
 	/* Unregister character device since it will not be used due to lack of memory. */
 	unregister_chrdev(iMajor, DEV_NAME);
 	return FAIL;
@@ -1167,6 +1462,10 @@ static int octvqe_init(void)
 
 		spin_lock_init(&g_apEchoChanInst[i]->Lock);
 
+		g_apEchoChanInst[i]->asRinSamples = g_pShm->aChan[i].asRinSamples;
+		g_apEchoChanInst[i]->asSinSamples = g_pShm->aChan[i].asSinSamples;
+		g_apEchoChanInst[i]->asSoutSamples = g_pShm->aChan[i].asSoutSamples;
+
 		g_apEchoChanInst[i]->iXinReadBuf = -1;
 		g_apEchoChanInst[i]->iSoutReadBuf = -1;
 	}
@@ -1198,6 +1497,9 @@ static void octvqe_exit(void)
 	}
     }
 
+    vfree(g_pShm);
+    g_pShm = NULL;
+
     unregister_chrdev(iMajor, DEV_NAME);
 
     printk(KERN_INFO "%s: Echo cancellation support unloaded\n", DEV_NAME);
@@ -36,6 +36,9 @@ int ZapOctVqeApiEcChannelTrainTap(void *f_pvEcChan, int f_iPos, short f_sVal);
 short ZapOctVqeApiEcChannelProcess(void *f_pvEcChan, short f_sRin,
 	short f_sSin);
 
+void ZapOctVqeApiEcChannelProcessBlock(void *f_pvEcChan, const short *f_psRin,
+	const short *f_psSin, short *f_psSout, int f_iLen);
+
 void ZapOctVqeApiEcChannelFree(void *f_pvEcChan);
 
 #endif /* __OCTVQE_LINUX_H__ */
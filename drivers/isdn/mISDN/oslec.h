@@ -37,7 +37,10 @@ struct echo_can_state {
 struct echo_can_state *oslec_echo_can_create(int len, int adaption_mode);
 void oslec_echo_can_free(struct echo_can_state *ec);
 short oslec_echo_can_update(struct echo_can_state *ec, short iref, short isig);
+void oslec_echo_can_update_block(struct echo_can_state *ec, const short *iref,
+				 const short *isig, short *out, int n);
 int oslec_echo_can_traintap(struct echo_can_state *ec, int pos, short val);
+void oslec_simd_init(void);
 static inline void echo_can_init(void) {}
 static inline void echo_can_shutdown(void) {}
 short oslec_hpf_tx(struct echo_can_state *ec, short txlin);
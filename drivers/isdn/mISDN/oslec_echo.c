@@ -123,6 +123,12 @@
 #include "oslec_bit_operations.h"
 #include "oslec_echo.h"
 
+#ifdef OSLEC_SIMD
+#include <asm/cpufeature.h>
+#include <asm/fpu/api.h>
+#include <linux/mISDNdsp.h>
+#endif
+
 #if !defined(NULL)
 #define NULL (void *) 0
 #endif
@@ -144,6 +150,316 @@
 
 \*-----------------------------------------------------------------------*/
 
+#ifdef OSLEC_SIMD
+/*
+   SSE2 and AVX2 kernels for the filter and the coefficient update on
+   x86_64.  Both work on the doubled history, so the taps and the
+   history are contiguous.  They must give exactly the same result as
+   the C code, including the wrap around of the 32 bit products, which
+   is checked by a self test before they are used.
+*/
+
+#define OSLEC_SIMD_SSE2   1
+#define OSLEC_SIMD_AVX2   2
+
+static int oslec_simd_level;
+
+static int32_t dot16_sse2(const int16_t *c, const int16_t *h, long n)
+{
+    int32_t y;
+
+    asm volatile(
+	"pxor %%xmm4, %%xmm4\n\t"
+	"1:\n\t"
+	"movdqu (%[c]), %%xmm0\n\t"
+	"movdqu (%[h]), %%xmm1\n\t"
+	"pmaddwd %%xmm1, %%xmm0\n\t"
+	"paddd %%xmm0, %%xmm4\n\t"
+	"add $16, %[c]\n\t"
+	"add $16, %[h]\n\t"
+	"sub $8, %[n]\n\t"
+	"jnz 1b\n\t"
+	"pshufd $0x4e, %%xmm4, %%xmm0\n\t"
+	"paddd %%xmm0, %%xmm4\n\t"
+	"pshufd $0xb1, %%xmm4, %%xmm0\n\t"
+	"paddd %%xmm0, %%xmm4\n\t"
+	"movd %%xmm4, %[y]\n\t"
+	: [y] "=r" (y), [c] "+r" (c), [h] "+r" (h), [n] "+r" (n)
+	: : "memory", "cc", "xmm0", "xmm1", "xmm4");
+    return y;
+}
+/*- End of function --------------------------------------------------------*/
+
+static int32_t dot16_avx2(const int16_t *c, const int16_t *h, long n)
+{
+    int32_t y;
+
+    asm volatile(
+	"vpxor %%ymm4, %%ymm4, %%ymm4\n\t"
+	"1:\n\t"
+	"vmovdqu (%[c]), %%ymm0\n\t"
+	"vpmaddwd (%[h]), %%ymm0, %%ymm0\n\t"
+	"vpaddd %%ymm0, %%ymm4, %%ymm4\n\t"
+	"add $32, %[c]\n\t"
+	"add $32, %[h]\n\t"
+	"sub $16, %[n]\n\t"
+	"jnz 1b\n\t"
+	"vextracti128 $1, %%ymm4, %%xmm0\n\t"
+	"vpaddd %%xmm0, %%xmm4, %%xmm4\n\t"
+	"vpshufd $0x4e, %%xmm4, %%xmm0\n\t"
+	"vpaddd %%xmm0, %%xmm4, %%xmm4\n\t"
+	"vpshufd $0xb1, %%xmm4, %%xmm0\n\t"
+	"vpaddd %%xmm0, %%xmm4, %%xmm4\n\t"
+	"vmovd %%xmm4, %[y]\n\t"
+	"vzeroupper\n\t"
+	: [y] "=r" (y), [c] "+r" (c), [h] "+r" (h), [n] "+r" (n)
+	: : "memory", "cc", "xmm0", "xmm4");
+    return y;
+}
+/*- End of function --------------------------------------------------------*/
+
+/* taps[i] += (int16_t) ((h[i]*factor + (1<<14)) >> 15), 8 taps per loop */
+static void lms16_sse2(int16_t *t, const int16_t *h, int factor, long n)
+{
+    asm volatile(
+	"movd %[f], %%xmm5\n\t"
+	"pshufd $0, %%xmm5, %%xmm5\n\t"
+	"movd %[r], %%xmm6\n\t"
+	"pshufd $0, %%xmm6, %%xmm6\n\t"
+	"1:\n\t"
+	"movdqu (%[h]), %%xmm0\n\t"
+	"movdqa %%xmm0, %%xmm1\n\t"
+	"punpcklwd %%xmm0, %%xmm0\n\t"
+	"punpckhwd %%xmm1, %%xmm1\n\t"
+	"psrad $16, %%xmm0\n\t"
+	"psrad $16, %%xmm1\n\t"
+	/* low 32 bits of the products, there is no pmulld in sse2 */
+	"movdqa %%xmm0, %%xmm2\n\t"
+	"movdqa %%xmm1, %%xmm3\n\t"
+	"psrlq $32, %%xmm2\n\t"
+	"psrlq $32, %%xmm3\n\t"
+	"pmuludq %%xmm5, %%xmm0\n\t"
+	"pmuludq %%xmm5, %%xmm1\n\t"
+	"pmuludq %%xmm5, %%xmm2\n\t"
+	"pmuludq %%xmm5, %%xmm3\n\t"
+	"pshufd $0x08, %%xmm0, %%xmm0\n\t"
+	"pshufd $0x08, %%xmm1, %%xmm1\n\t"
+	"pshufd $0x08, %%xmm2, %%xmm2\n\t"
+	"pshufd $0x08, %%xmm3, %%xmm3\n\t"
+	"punpckldq %%xmm2, %%xmm0\n\t"
+	"punpckldq %%xmm3, %%xmm1\n\t"
+	/* round, shift and truncate to 16 bits */
+	"paddd %%xmm6, %%xmm0\n\t"
+	"paddd %%xmm6, %%xmm1\n\t"
+	"psrad $15, %%xmm0\n\t"
+	"psrad $15, %%xmm1\n\t"
+	"pslld $16, %%xmm0\n\t"
+	"pslld $16, %%xmm1\n\t"
+	"psrad $16, %%xmm0\n\t"
+	"psrad $16, %%xmm1\n\t"
+	"packssdw %%xmm1, %%xmm0\n\t"
+	"movdqu (%[t]), %%xmm1\n\t"
+	"paddw %%xmm1, %%xmm0\n\t"
+	"movdqu %%xmm0, (%[t])\n\t"
+	"add $16, %[t]\n\t"
+	"add $16, %[h]\n\t"
+	"sub $8, %[n]\n\t"
+	"jnz 1b\n\t"
+	: [t] "+r" (t), [h] "+r" (h), [n] "+r" (n)
+	: [f] "r" (factor), [r] "r" (1 << 14)
+	: "memory", "cc", "xmm0", "xmm1", "xmm2", "xmm3", "xmm5", "xmm6");
+}
+/*- End of function --------------------------------------------------------*/
+
+static void lms16_avx2(int16_t *t, const int16_t *h, int factor, long n)
+{
+    asm volatile(
+	"vmovd %[f], %%xmm5\n\t"
+	"vpbroadcastd %%xmm5, %%ymm5\n\t"
+	"vmovd %[r], %%xmm6\n\t"
+	"vpbroadcastd %%xmm6, %%ymm6\n\t"
+	"1:\n\t"
+	"vpmovsxwd (%[h]), %%ymm0\n\t"
+	"vpmulld %%ymm5, %%ymm0, %%ymm0\n\t"
+	"vpaddd %%ymm6, %%ymm0, %%ymm0\n\t"
+	"vpsrad $15, %%ymm0, %%ymm0\n\t"
+	"vpslld $16, %%ymm0, %%ymm0\n\t"
+	"vpsrad $16, %%ymm0, %%ymm0\n\t"
+	"vextracti128 $1, %%ymm0, %%xmm1\n\t"
+	"vpackssdw %%xmm1, %%xmm0, %%xmm0\n\t"
+	"vpaddw (%[t]), %%xmm0, %%xmm0\n\t"
+	"vmovdqu %%xmm0, (%[t])\n\t"
+	"add $16, %[t]\n\t"
+	"add $16, %[h]\n\t"
+	"sub $8, %[n]\n\t"
+	"jnz 1b\n\t"
+	"vzeroupper\n\t"
+	: [t] "+r" (t), [h] "+r" (h), [n] "+r" (n)
+	: [f] "r" (factor), [r] "r" (1 << 14)
+	: "memory", "cc", "xmm0", "xmm1", "xmm5", "xmm6");
+}
+/*- End of function --------------------------------------------------------*/
+
+/* level 0 is the plain C code, which also does the remaining taps */
+static int32_t dot16(int level, const int16_t *c, const int16_t *h, int taps)
+{
+    int32_t y;
+    int i;
+
+    y = 0;
+    i = 0;
+    if (level == OSLEC_SIMD_AVX2) {
+	i = taps & ~15;
+	if (i)
+	    y = dot16_avx2(c, h, i);
+    } else if (level == OSLEC_SIMD_SSE2) {
+	i = taps & ~7;
+	if (i)
+	    y = dot16_sse2(c, h, i);
+    }
+    for (  ;  i < taps;  i++)
+	y += c[i]*h[i];
+    return y;
+}
+/*- End of function --------------------------------------------------------*/
+
+static void lms16(int level, int16_t *t, const int16_t *h, int factor, int taps)
+{
+    int i;
+
+    i = 0;
+    if (level) {
+	i = taps & ~7;
+	if (i && level == OSLEC_SIMD_AVX2)
+	    lms16_avx2(t, h, factor, i);
+	else if (i)
+	    lms16_sse2(t, h, factor, i);
+    }
+    for (  ;  i < taps;  i++)
+	t[i] += (int16_t) ((h[i]*factor + (1<<14)) >> 15);
+}
+/*- End of function --------------------------------------------------------*/
+
+static inline int16_t ec_fir16(struct echo_can_state_s *ec,
+			       struct fir16_state *fir, int16_t sample)
+{
+    int32_t y;
+
+    if (!ec->simd)
+	return fir16(fir, sample);
+
+    fir->history[fir->curr_pos] = sample;
+    fir->history[fir->curr_pos + fir->taps] = sample;
+    y = dot16(ec->simd, fir->coeffs, &fir->history[fir->curr_pos],
+	      fir->taps);
+    if (fir->curr_pos <= 0)
+	fir->curr_pos = fir->taps;
+    fir->curr_pos--;
+    return (int16_t) (y >> 15);
+}
+/*- End of function --------------------------------------------------------*/
+
+#define SELFTEST_TAPS 264
+
+static int16_t selftest_rand(uint32_t *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    /* some full scale samples, to check the overflow of the products */
+    if ((*seed >> 8 & 0x1f) == 0)
+	return -32768;
+    return (int16_t) (*seed >> 16);
+}
+
+/* compare the kernels of the given level with the C code */
+static int oslec_simd_selftest(int level)
+{
+    static const int taps[] = { 8, 16, 37, 128, 256, 263 };
+    static const int shifts[] = { -12, -3, 0, 4, 12 };
+    int16_t *c, *h, *t0, *t1;
+    uint32_t seed = 1;
+    int i, j, k, factor;
+    int err = 0;
+
+    c = malloc(4*SELFTEST_TAPS*sizeof(int16_t));
+    if (c == NULL)
+	return -1;
+    h = c + SELFTEST_TAPS;
+    t0 = h + SELFTEST_TAPS;
+    t1 = t0 + SELFTEST_TAPS;
+
+    kernel_fpu_begin();
+    for (i = 0;  i < ARRAY_SIZE(taps) && !err;  i++) {
+	for (j = 0;  j < SELFTEST_TAPS;  j++) {
+	    c[j] = selftest_rand(&seed);
+	    h[j] = selftest_rand(&seed);
+	    t0[j] = t1[j] = selftest_rand(&seed);
+	}
+	if (dot16(level, c, h, taps[i]) != dot16(0, c, h, taps[i]))
+	    err = -1;
+	for (k = 0;  k < ARRAY_SIZE(shifts);  k++) {
+	    factor = selftest_rand(&seed);
+	    if (shifts[k] > 0)
+		factor <<= shifts[k];
+	    else
+		factor >>= -shifts[k];
+	    lms16(level, t1, h, factor, taps[i]);
+	    lms16(0, t0, h, factor, taps[i]);
+	}
+	if (memcmp(t0, t1, SELFTEST_TAPS*sizeof(int16_t)))
+	    err = -1;
+    }
+    kernel_fpu_end();
+
+    free(c);
+    return err;
+}
+/*- End of function --------------------------------------------------------*/
+
+void oslec_simd_init(void)
+{
+    static const char * const name[] = { "C", "SSE2", "AVX2" };
+    int level = 0;
+
+    if (boot_cpu_has(X86_FEATURE_AVX2) &&
+	cpu_has_xfeatures(XFEATURE_MASK_SSE | XFEATURE_MASK_YMM, NULL))
+	level = OSLEC_SIMD_AVX2;
+    else if (boot_cpu_has(X86_FEATURE_XMM2))
+	level = OSLEC_SIMD_SSE2;
+
+    while (level && oslec_simd_selftest(level)) {
+	printk(KERN_WARNING "oslec: %s self test failed\n", name[level]);
+	level--;
+    }
+    oslec_simd_level = level;
+    printk(KERN_INFO "oslec: using %s filter kernels\n", name[level]);
+}
+/*- End of function --------------------------------------------------------*/
+
+/* the kernels are only used between oslec_simd_begin() and _end(), the
+   fpu section is shared with the dsp, which may hold it for a whole batch */
+int oslec_simd_begin(int *fpu)
+{
+    *fpu = 0;
+    if (!oslec_simd_level)
+	return 0;
+    *fpu = dsp_fpu_begin();
+    return *fpu ? oslec_simd_level : 0;
+}
+/*- End of function --------------------------------------------------------*/
+
+void oslec_simd_end(int fpu)
+{
+    dsp_fpu_end(fpu);
+}
+/*- End of function --------------------------------------------------------*/
+#else
+void oslec_simd_init(void)
+{
+}
+
+#define ec_fir16(ec, fir, sample) fir16(fir, sample)
+#endif
+
 /* adapting coeffs using the traditional stochastic descent (N)LMS algorithm */
 
 
@@ -235,6 +551,14 @@ lms_adapt_bg(struct echo_can_state_s *ec, int clean, int shift)
     else
 	factor = clean >> -shift;
 
+#ifdef OSLEC_SIMD
+    if (ec->simd) {
+	lms16(ec->simd, ec->fir_taps16[1],
+	      &ec->fir_state_bg.history[ec->curr_pos], factor, ec->taps);
+	return;
+    }
+#endif
+
     /* Update the FIR taps */
 
     offset2 = ec->curr_pos;
@@ -448,14 +772,14 @@ int16_t echo_can_update(struct echo_can_state_s *ec, int16_t tx, int16_t rx)
     /* Foreground filter ---------------------------------------------------*/
 
     ec->fir_state.coeffs = ec->fir_taps16[0];
-    echo_value = fir16(&ec->fir_state, tx);
+    echo_value = ec_fir16(ec, &ec->fir_state, tx);
     ec->clean = rx - echo_value;
     ec->Lcleanacc += abs(ec->clean) - ec->Lclean;
     ec->Lclean = (ec->Lcleanacc + (1<<4)) >> 5;
 
     /* Background filter ---------------------------------------------------*/
 
-    echo_value = fir16(&ec->fir_state_bg, tx);
+    echo_value = ec_fir16(ec, &ec->fir_state_bg, tx);
     clean_bg = rx - echo_value;
     ec->Lclean_bgacc += abs(clean_bg) - ec->Lclean_bg;
     ec->Lclean_bg = (ec->Lclean_bgacc + (1<<4)) >> 5;
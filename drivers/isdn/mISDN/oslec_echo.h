@@ -143,6 +143,7 @@ struct echo_can_state_s {
     int taps;
     int log2taps;
     int adaption_mode;
+    int simd;		/* simd kernels that may be used, see oslec_simd_begin() */
 
     int cond_met;
     int32_t Pstates;
@@ -219,5 +220,27 @@ int16_t echo_can_update(struct echo_can_state_s *ec, int16_t tx, int16_t rx);
 */
 int16_t echo_can_hpf_tx(struct echo_can_state_s *ec, int16_t tx);
 
+/*! Select the filter kernels for this cpu, called once at module load. */
+void oslec_simd_init(void);
+
+/*! Enable the simd kernels for the following updates, if the fpu is usable.
+    \param fpu Returns the value to pass to oslec_simd_end().
+    \return The value for the simd field of the contexts, 0 for none.
+*/
+#ifdef OSLEC_SIMD
+int oslec_simd_begin(int *fpu);
+void oslec_simd_end(int fpu);
+#else
+static inline int oslec_simd_begin(int *fpu)
+{
+    *fpu = 0;
+    return 0;
+}
+
+static inline void oslec_simd_end(int fpu)
+{
+}
+#endif
+
 #endif
 /*- End of file ------------------------------------------------------------*/
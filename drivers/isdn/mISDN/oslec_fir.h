@@ -68,6 +68,15 @@
 #include "mmx.h"
 #endif
 
+/*
+   On x86_64 the echo canceller selects SSE2 or AVX2 kernels at module
+   load.  They need the history twice in a row, like the MMX code, so
+   the scalar fir16() keeps the second copy up to date as well.
+*/
+#if defined(__KERNEL__) && defined(CONFIG_X86_64)
+#define OSLEC_SIMD
+#endif
+
 /*!
     16 bit integer FIR descriptor. This defines the working state for a single
     instance of an FIR filter using 16 bit integer coefficients.
@@ -113,7 +122,8 @@ static inline const int16_t *fir16_create(struct fir16_state *fir,
     fir->taps = taps;
     fir->curr_pos = taps - 1;
     fir->coeffs = coeffs;
-#if defined(USE_MMX)  ||  defined(USE_SSE2) || defined(__BLACKFIN_ASM__)
+#if defined(USE_MMX)  ||  defined(USE_SSE2) || defined(__BLACKFIN_ASM__) || \
+    defined(OSLEC_SIMD)
     fir->history = malloc(2*taps*sizeof(int16_t));
     if (fir->history)
 	memset(fir->history, 0, 2*taps*sizeof(int16_t));
@@ -128,7 +138,8 @@ static inline const int16_t *fir16_create(struct fir16_state *fir,
 
 static inline void fir16_flush(struct fir16_state *fir)
 {
-#if defined(USE_MMX)  ||  defined(USE_SSE2) || defined(__BLACKFIN_ASM__)
+#if defined(USE_MMX)  ||  defined(USE_SSE2) || defined(__BLACKFIN_ASM__) || \
+    defined(OSLEC_SIMD)
     memset(fir->history, 0, 2*fir->taps*sizeof(int16_t));
 #else
     memset(fir->history, 0, fir->taps*sizeof(int16_t));
@@ -250,6 +261,9 @@ static inline int16_t fir16(struct fir16_state *fir, int16_t sample)
     int offset2;
 
     fir->history[fir->curr_pos] = sample;
+#ifdef OSLEC_SIMD
+    fir->history[fir->curr_pos + fir->taps] = sample;
+#endif
 
     offset2 = fir->curr_pos;
     offset1 = fir->taps - offset2;
@@ -97,6 +97,19 @@ short oslec_echo_can_update(struct echo_can_state *ec, short iref, short isig)
     return clean;
 }
 
+void oslec_echo_can_update_block(struct echo_can_state *ec, const short *iref,
+				 const short *isig, short *out, int n)
+{
+  struct echo_can_state_s *s = (struct echo_can_state_s *)(ec->ec);
+  int i, fpu;
+
+  s->simd = oslec_simd_begin(&fpu);
+  for (i = 0; i < n; i++)
+    out[i] = echo_can_update(s, iref[i], isig[i]);
+  oslec_simd_end(fpu);
+  s->simd = 0;
+}
+
 int oslec_echo_can_traintap(struct echo_can_state *ec, int pos, short val)
 {
 	return 0;
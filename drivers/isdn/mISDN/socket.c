@@ -16,8 +16,15 @@
  */
 
 #include <linux/mISDNif.h>
+#include <linux/mISDNhw.h>
 #include <linux/slab.h>
 #include <linux/export.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/file.h>
+#include <linux/uio.h>
+#include <linux/sched/signal.h>
 #include "core.h"
 
 static u_int	*debug;
@@ -34,11 +41,11 @@ static struct proto mISDN_proto = {
 #define _pms(sk)	((struct mISDN_sock *)sk)
 
 static struct mISDN_sock_list	data_sockets = {
-	.lock = __RW_LOCK_UNLOCKED(data_sockets.lock)
+	.lock = __SPIN_LOCK_UNLOCKED(data_sockets.lock)
 };
 
 static struct mISDN_sock_list	base_sockets = {
-	.lock = __RW_LOCK_UNLOCKED(base_sockets.lock)
+	.lock = __SPIN_LOCK_UNLOCKED(base_sockets.lock)
 };
 
 #define L2_HEADER_LEN	4
@@ -54,19 +61,90 @@ _l2_alloc_skb(unsigned int len, gfp_t gfp_mask)
 	return skb;
 }
 
+/*
+ * mmap ring of a data socket
+ * frames are used strictly in order, the kernel owns a frame while its
+ * status is MISDN_FRAME_KERNEL, otherwise the application owns it
+ */
+#define MISDN_RING_MAX_FRAMES	4096
+
+struct mISDN_ring {
+	u8		*buf;
+	u_int		frame_size;
+	u_int		frame_nr;
+	u_int		size;		/* page aligned size of buf */
+	u_int		head;		/* next frame used by the kernel */
+	u_int		dropped;
+};
+
+static inline struct mISDN_frame_hdr *
+mISDN_ring_frame(struct mISDN_ring *r, u_int idx)
+{
+	return (struct mISDN_frame_hdr *)(r->buf + idx * r->frame_size);
+}
+
+static void
+mISDN_ring_free(struct mISDN_ring *r)
+{
+	if (!r)
+		return;
+	vfree(r->buf);
+	kfree(r);
+}
+
+/* copy a frame into the rx ring, called with the receive queue lock */
+static bool
+mISDN_ring_rcv(struct mISDN_ring *r, struct sk_buff *skb)
+{
+	struct mISDN_frame_hdr	*fh;
+	u32			status = MISDN_FRAME_USER;
+
+	fh = mISDN_ring_frame(r, r->head);
+	if (smp_load_acquire(&fh->status) != MISDN_FRAME_KERNEL ||
+	    skb->len > r->frame_size - MISDN_FRAME_HDRLEN) {
+		r->dropped++;
+		return false;
+	}
+	if (r->dropped) {
+		status |= MISDN_FRAME_LOSING;
+		r->dropped = 0;
+	}
+	fh->len = skb->len;
+	fh->prim = mISDN_HEAD_PRIM(skb);
+	fh->id = mISDN_HEAD_ID(skb);
+	fh->tstamp = ktime_get_real_ns();
+	fh->error = 0;
+	skb_copy_bits(skb, 0, (u8 *)fh + MISDN_FRAME_HDRLEN, skb->len);
+	smp_store_release(&fh->status, status);
+	if (++r->head == r->frame_nr)
+		r->head = 0;
+	return true;
+}
+
 static void
 mISDN_sock_link(struct mISDN_sock_list *l, struct sock *sk)
 {
-	write_lock_bh(&l->lock);
-	sk_add_node(sk, &l->head);
-	write_unlock_bh(&l->lock);
+	spin_lock_bh(&l->lock);
+	sk_add_node_rcu(sk, &l->head);
+	spin_unlock_bh(&l->lock);
 }
 
 static void mISDN_sock_unlink(struct mISDN_sock_list *l, struct sock *sk)
 {
-	write_lock_bh(&l->lock);
-	sk_del_node_init(sk);
-	write_unlock_bh(&l->lock);
+	spin_lock_bh(&l->lock);
+	sk_del_node_init_rcu(sk);
+	spin_unlock_bh(&l->lock);
+}
+
+/*
+ * the socket lists are walked under rcu, so a reader may still queue a
+ * frame after release, the socket is freed after a grace period and the
+ * queue is purged here
+ */
+static void
+mISDN_sock_destruct(struct sock *sk)
+{
+	skb_queue_purge(&sk->sk_receive_queue);
 }
 
 static int
@@ -80,6 +158,28 @@ mISDN_send(struct mISDNchannel *ch, struct sk_buff *skb)
 		printk(KERN_DEBUG "%s len %d %p\n", __func__, skb->len, skb);
 	if (msk->sk.sk_state == MISDN_CLOSED)
 		return -EUNATCH;
+	/* the channel has room again, send the rest of the tx ring */
+	if (mISDN_HEAD_PRIM(skb) == PH_DATA_CNF && READ_ONCE(msk->tx_ring))
+		schedule_work(&msk->tx_work);
+	if (msk->rx_ring) {
+		struct sk_buff_head	*q = &msk->sk.sk_receive_queue;
+		u_long			flags;
+		bool			queued = false;
+
+		spin_lock_irqsave(&q->lock, flags);
+		if (msk->rx_ring)
+			queued = mISDN_ring_rcv(msk->rx_ring, skb);
+		spin_unlock_irqrestore(&q->lock, flags);
+		if (queued) {
+			consume_skb(skb);
+			msk->sk.sk_data_ready(&msk->sk);
+		} else {
+			/* ring full, the application is too slow */
+			atomic_inc(&msk->sk.sk_drops);
+			kfree_skb(skb);
+		}
+		return 0;
+	}
 	__net_timestamp(skb);
 	err = sock_queue_rcv_skb(&msk->sk, skb);
 	if (err)
@@ -163,10 +263,10 @@ mISDN_sock_recvmsg(struct socket *sock, struct msghdr *msg, size_t len,
 			skb_queue_head(&sk->sk_receive_queue, skb);
 		return -ENOSPC;
 	}
-	memcpy(skb_push(skb, MISDN_HEADER_LEN), mISDN_HEAD_P(skb),
-	       MISDN_HEADER_LEN);
-
-	err = skb_copy_datagram_msg(skb, 0, msg, copied);
+	/* the data may be shared with other sockets, don't push the header */
+	err = memcpy_to_msg(msg, mISDN_HEAD_P(skb), MISDN_HEADER_LEN);
+	if (!err)
+		err = skb_copy_datagram_msg(skb, 0, msg, skb->len);
 
 	mISDN_sock_cmsg(sk, msg, skb);
 
@@ -175,6 +275,100 @@ mISDN_sock_recvmsg(struct socket *sock, struct msghdr *msg, size_t len,
 	return err ? : copied;
 }
 
+/*
+ * the raw B-channel of a socket, it takes only the frame in the fifo and one
+ * next frame
+ */
+static struct bchannel *
+mISDN_sock_bchannel(struct sock *sk)
+{
+	struct mISDNdevice	*dev = _pms(sk)->dev;
+
+	if (sk->sk_protocol < ISDN_P_B_START || !dev ||
+	    !((1 << (sk->sk_protocol & ISDN_P_B_MASK)) & dev->Bprotocols))
+		return NULL;
+	return container_of(_pms(sk)->ch.peer, struct bchannel, ch);
+}
+
+/*
+ * send all frames of the tx ring, which are marked by the application
+ * a frame, which cannot be sent, is given back with the error in its header,
+ * if the channel is busy, the rest is sent on PH_DATA_CNF
+ */
+static int
+mISDN_ring_send(struct sock *sk)
+{
+	struct mISDN_ring	*r;
+	struct mISDN_frame_hdr	*fh;
+	struct bchannel		*bch;
+	struct sk_buff		*skb;
+	u_int			len;
+	int			err = 0, sent = 0;
+
+	if (sk->sk_state != MISDN_BOUND)
+		return -EBADFD;
+
+	lock_sock(sk);
+	r = _pms(sk)->tx_ring;
+	if (!r) {
+		err = -EINVAL;
+		goto done;
+	}
+	if (!_pms(sk)->ch.peer) {
+		err = -ENODEV;
+		goto done;
+	}
+	bch = mISDN_sock_bchannel(sk);
+	for (;;) {
+		fh = mISDN_ring_frame(r, r->head);
+		if (smp_load_acquire(&fh->status) != MISDN_FRAME_USER)
+			break;
+		len = READ_ONCE(fh->len);
+		if (!len) {
+			err = -EINVAL;
+			goto next;
+		}
+		if (len > r->frame_size - MISDN_FRAME_HDRLEN) {
+			err = -EMSGSIZE;
+			goto next;
+		}
+		if (bch && test_bit(FLG_TX_NEXT, &bch->Flags))
+			break;
+		skb = _l2_alloc_skb(len, GFP_KERNEL);
+		if (!skb) {
+			err = -ENOMEM;
+			break;
+		}
+		memcpy(skb_put(skb, len), (u8 *)fh + MISDN_FRAME_HDRLEN, len);
+		mISDN_HEAD_PRIM(skb) = fh->prim;
+		mISDN_HEAD_ID(skb) = fh->id;
+		err = _pms(sk)->ch.recv(_pms(sk)->ch.peer, skb);
+		if (err) {
+			kfree_skb(skb);
+			/* keep the frame, it is sent again on PH_DATA_CNF */
+			if (err == -EBUSY)
+				break;
+		} else
+			sent += len;
+next:
+		fh->error = err;
+		smp_store_release(&fh->status, MISDN_FRAME_KERNEL);
+		if (++r->head == r->frame_nr)
+			r->head = 0;
+	}
+done:
+	release_sock(sk);
+	return sent ? sent : err;
+}
+
+static void
+mISDN_ring_tx_work(struct work_struct *work)
+{
+	struct mISDN_sock *msk = container_of(work, struct mISDN_sock, tx_work);
+
+	mISDN_ring_send(&msk->sk);
+}
+
 static int
 mISDN_sock_sendmsg(struct socket *sock, struct msghdr *msg, size_t len)
 {
@@ -193,6 +387,10 @@ mISDN_sock_sendmsg(struct socket *sock, struct msghdr *msg, size_t len)
 	if (msg->msg_flags & ~(MSG_DONTWAIT | MSG_NOSIGNAL | MSG_ERRQUEUE))
 		return -EINVAL;
 
+	/* an empty message flushes the tx ring */
+	if (!len && _pms(sk)->tx_ring)
+		return mISDN_ring_send(sk);
+
 	if (len < MISDN_HEADER_LEN)
 		return -EINVAL;
 
@@ -245,6 +443,151 @@ done:
 	return err;
 }
 
+/* replace a ring, called with the socket lock, a NULL ring removes it */
+static void
+mISDN_ring_set(struct sock *sk, struct mISDN_ring **rp, struct mISDN_ring *r)
+{
+	struct mISDN_ring *old;
+
+	spin_lock_irq(&sk->sk_receive_queue.lock);
+	old = *rp;
+	*rp = r;
+	spin_unlock_irq(&sk->sk_receive_queue.lock);
+	mISDN_ring_free(old);
+}
+
+static int
+mISDN_ring_setup(struct sock *sk, struct mISDN_ring **rp,
+		 struct mISDN_ring_req *req)
+{
+	struct mISDN_ring *r = NULL;
+
+	if (atomic_read(&_pms(sk)->mapped))
+		return -EBUSY;
+	if (req->frame_nr) {
+		if (req->frame_size <= MISDN_FRAME_HDRLEN ||
+		    req->frame_size > MISDN_FRAME_HDRLEN + MAX_DATA_SIZE ||
+		    (req->frame_size & (MISDN_RING_ALIGNMENT - 1)) ||
+		    req->frame_nr > MISDN_RING_MAX_FRAMES)
+			return -EINVAL;
+		r = kzalloc(sizeof(*r), GFP_KERNEL);
+		if (!r)
+			return -ENOMEM;
+		r->frame_size = req->frame_size;
+		r->frame_nr = req->frame_nr;
+		r->size = PAGE_ALIGN(r->frame_size * r->frame_nr);
+		/* zeroed, so all frames belong to the kernel */
+		r->buf = vmalloc_user(r->size);
+		if (!r->buf) {
+			kfree(r);
+			return -ENOMEM;
+		}
+	}
+	mISDN_ring_set(sk, rp, r);
+	return 0;
+}
+
+static void
+data_sock_vm_open(struct vm_area_struct *vma)
+{
+	struct socket	*sock = vma->vm_file->private_data;
+
+	if (sock->sk)
+		atomic_inc(&_pms(sock->sk)->mapped);
+}
+
+static void
+data_sock_vm_close(struct vm_area_struct *vma)
+{
+	struct socket	*sock = vma->vm_file->private_data;
+
+	if (sock->sk)
+		atomic_dec(&_pms(sock->sk)->mapped);
+}
+
+static const struct vm_operations_struct data_sock_vm_ops = {
+	.open	= data_sock_vm_open,
+	.close	= data_sock_vm_close,
+};
+
+/*
+ * insert the pages of a ring at start, vm_insert_page() is available on all
+ * kernels, remap_vmalloc_range_partial() is not exported
+ */
+static int
+data_sock_remap(struct vm_area_struct *vma, u_long start, struct mISDN_ring *r)
+{
+	u_long	off;
+	int	err;
+
+	for (off = 0; off < r->size; off += PAGE_SIZE) {
+		err = vm_insert_page(vma, start + off,
+				     vmalloc_to_page(r->buf + off));
+		if (err)
+			return err;
+	}
+	return 0;
+}
+
+static int
+data_sock_mmap(struct file *file, struct socket *sock,
+	       struct vm_area_struct *vma)
+{
+	struct sock		*sk = sock->sk;
+	struct mISDN_ring	*rx, *tx;
+	u_long			size, start = vma->vm_start;
+	int			err = -EINVAL;
+
+	if (vma->vm_pgoff)
+		return -EINVAL;
+
+	lock_sock(sk);
+	rx = _pms(sk)->rx_ring;
+	tx = _pms(sk)->tx_ring;
+	size = (rx ? rx->size : 0) + (tx ? tx->size : 0);
+	if (!size || vma->vm_end - vma->vm_start != size)
+		goto done;
+	if (rx) {
+		err = data_sock_remap(vma, start, rx);
+		if (err)
+			goto done;
+		start += rx->size;
+	}
+	if (tx) {
+		err = data_sock_remap(vma, start, tx);
+		if (err)
+			goto done;
+	}
+	vma->vm_flags |= VM_DONTEXPAND;
+	vma->vm_ops = &data_sock_vm_ops;
+	atomic_inc(&_pms(sk)->mapped);
+done:
+	release_sock(sk);
+	return err;
+}
+
+static unsigned int
+data_sock_poll(struct file *file, struct socket *sock, poll_table *wait)
+{
+	struct sock		*sk = sock->sk;
+	struct mISDN_ring	*r;
+	struct mISDN_frame_hdr	*fh;
+	unsigned int		mask;
+
+	mask = datagram_poll(file, sock, wait);
+	spin_lock_irq(&sk->sk_receive_queue.lock);
+	r = _pms(sk)->rx_ring;
+	if (r) {
+		/* the last filled frame is still unread */
+		fh = mISDN_ring_frame(r, r->head ? r->head - 1 :
+				      r->frame_nr - 1);
+		if (READ_ONCE(fh->status) != MISDN_FRAME_KERNEL)
+			mask |= POLLIN | POLLRDNORM;
+	}
+	spin_unlock_irq(&sk->sk_receive_queue.lock);
+	return mask;
+}
+
 static int
 data_sock_release(struct socket *sock)
 {
@@ -277,11 +620,15 @@ data_sock_release(struct socket *sock)
 		break;
 	}
 
+	cancel_work_sync(&_pms(sk)->tx_work);
 	lock_sock(sk);
 
 	sock_orphan(sk);
 	skb_queue_purge(&sk->sk_receive_queue);
 
+	mISDN_ring_set(sk, &_pms(sk)->rx_ring, NULL);
+	mISDN_ring_set(sk, &_pms(sk)->tx_ring, NULL);
+
 	release_sock(sk);
 	sock_put(sk);
 
@@ -417,6 +764,7 @@ static int data_sock_setsockopt(struct socket *sock, int level, int optname,
 				char __user *optval, unsigned int len)
 {
 	struct sock *sk = sock->sk;
+	struct mISDN_ring_req req;
 	int err = 0, opt = 0;
 
 	if (*debug & DEBUG_SOCKET)
@@ -437,6 +785,20 @@ static int data_sock_setsockopt(struct socket *sock, int level, int optname,
 		else
 			_pms(sk)->cmask &= ~MISDN_TIME_STAMP;
 		break;
+	case MISDN_RX_RING:
+	case MISDN_TX_RING:
+		if (len < sizeof(req)) {
+			err = -EINVAL;
+			break;
+		}
+		if (copy_from_user(&req, optval, sizeof(req))) {
+			err = -EFAULT;
+			break;
+		}
+		err = mISDN_ring_setup(sk, optname == MISDN_RX_RING ?
+				       &_pms(sk)->rx_ring : &_pms(sk)->tx_ring,
+				       &req);
+		break;
 	default:
 		err = -ENOPROTOOPT;
 		break;
@@ -502,8 +864,8 @@ data_sock_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 	}
 
 	if (sk->sk_protocol < ISDN_P_B_START) {
-		read_lock_bh(&data_sockets.lock);
-		sk_for_each(csk, &data_sockets.head) {
+		rcu_read_lock();
+		sk_for_each_rcu(csk, &data_sockets.head) {
 			if (sk == csk)
 				continue;
 			if (_pms(csk)->dev != _pms(sk)->dev)
@@ -513,11 +875,11 @@ data_sock_bind(struct socket *sock, struct sockaddr *addr, int addr_len)
 			if (IS_ISDN_P_TE(csk->sk_protocol)
 			    == IS_ISDN_P_TE(sk->sk_protocol))
 				continue;
-			read_unlock_bh(&data_sockets.lock);
+			rcu_read_unlock();
 			err = -EBUSY;
 			goto done;
 		}
-		read_unlock_bh(&data_sockets.lock);
+		rcu_read_unlock();
 	}
 
 	_pms(sk)->ch.send = mISDN_send;
@@ -592,7 +954,7 @@ static const struct proto_ops data_sock_ops = {
 	.getname	= data_sock_getname,
 	.sendmsg	= mISDN_sock_sendmsg,
 	.recvmsg	= mISDN_sock_recvmsg,
-	.poll		= datagram_poll,
+	.poll		= data_sock_poll,
 	.listen		= sock_no_listen,
 	.shutdown	= sock_no_shutdown,
 	.setsockopt	= data_sock_setsockopt,
@@ -600,7 +962,7 @@ static const struct proto_ops data_sock_ops = {
 	.connect	= sock_no_connect,
 	.socketpair	= sock_no_socketpair,
 	.accept		= sock_no_accept,
-	.mmap		= sock_no_mmap
+	.mmap		= data_sock_mmap
 };
 
 static int
@@ -620,6 +982,9 @@ data_sock_create(struct net *net, struct socket *sock, int protocol, int kern)
 	sock->ops = &data_sock_ops;
 	sock->state = SS_UNCONNECTED;
 	sock_reset_flag(sk, SOCK_ZAPPED);
+	sock_set_flag(sk, SOCK_RCU_FREE);
+	sk->sk_destruct = mISDN_sock_destruct;
+	INIT_WORK(&_pms(sk)->tx_work, mISDN_ring_tx_work);
 
 	sk->sk_protocol = protocol;
 	sk->sk_state    = MISDN_OPEN;
@@ -644,6 +1009,68 @@ base_sock_release(struct socket *sock)
 	return 0;
 }
 
+/*
+ * receive or send one frame on each data socket of the list without
+ * blocking, returns the number of frames moved
+ */
+static int
+mISDN_sock_batch(struct mISDN_batch __user *p, int tx)
+{
+	struct mISDN_batch	b;
+	struct mISDN_batch_msg	m;
+	struct mISDN_batch_msg __user *msgs;
+	struct socket		*dsock;
+	struct msghdr		msg;
+	struct iovec		iov;
+	u_int			i;
+	int			err, cnt = 0;
+
+	if (copy_from_user(&b, p, sizeof(b)))
+		return -EFAULT;
+	if (b.nr > MISDN_BATCH_MAX)
+		return -EINVAL;
+	msgs = u64_to_user_ptr(b.msgs);
+	for (i = 0; i < b.nr; i++) {
+		if (fatal_signal_pending(current))
+			return cnt ? cnt : -EINTR;
+		if (copy_from_user(&m, &msgs[i], sizeof(m)))
+			return -EFAULT;
+		dsock = sockfd_lookup(m.fd, &err);
+		if (!dsock) {
+			m.result = err;
+			goto next;
+		}
+		if (dsock->ops != &data_sock_ops) {
+			m.result = -ENOTSOCK;
+			goto put;
+		}
+		memset(&msg, 0, sizeof(msg));
+		m.result = import_single_range(tx ? WRITE : READ,
+					       u64_to_user_ptr(m.buf), m.len,
+					       &iov, &msg.msg_iter);
+		if (m.result)
+			goto put;
+		msg.msg_name = &m.addr;
+		if (tx) {
+			if (m.addr.family == AF_ISDN)
+				msg.msg_namelen = sizeof(m.addr);
+			msg.msg_flags = MSG_DONTWAIT;
+			m.result = mISDN_sock_sendmsg(dsock, &msg, m.len);
+		} else
+			m.result = mISDN_sock_recvmsg(dsock, &msg, m.len,
+						      MSG_DONTWAIT);
+		if (m.result >= 0)
+			cnt++;
+put:
+		sockfd_put(dsock);
+next:
+		if (copy_to_user(&msgs[i], &m, sizeof(m)))
+			return -EFAULT;
+		cond_resched();
+	}
+	return cnt;
+}
+
 static int
 base_sock_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 {
@@ -702,6 +1129,11 @@ base_sock_ioctl(struct socket *sock, unsigned int cmd, unsigned long arg)
 			err = -ENODEV;
 	}
 	break;
+	case IMRECVBATCH:
+	case IMSENDBATCH:
+		err = mISDN_sock_batch((struct mISDN_batch __user *)arg,
+				       cmd == IMSENDBATCH);
+		break;
 	default:
 		err = -EINVAL;
 	}
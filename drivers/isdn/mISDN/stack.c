@@ -18,9 +18,14 @@
 #include <linux/slab.h>
 #include <linux/mISDNif.h>
 #include <linux/kthread.h>
+#include <linux/percpu.h>
+#include <linux/irq.h>
 #include <linux/sched.h>
+#include <uapi/linux/sched/types.h>
 #include <linux/sched/cputime.h>
 #include <linux/signal.h>
+#include <linux/debugfs.h>
+#include <linux/seq_file.h>
 
 #include "core.h"
 
@@ -30,11 +35,16 @@ static inline void
 _queue_message(struct mISDNstack *st, struct sk_buff *skb)
 {
 	struct mISDNhead	*hh = mISDN_HEAD_P(skb);
+	u_int			len;
 
 	if (*debug & DEBUG_QUEUE_FUNC)
 		printk(KERN_DEBUG "%s prim(%x) id(%x) %p\n",
 		       __func__, hh->prim, hh->id, skb);
 	skb_queue_tail(&st->msgq, skb);
+	/* racy, but good enough for a statistic */
+	len = skb_queue_len(&st->msgq);
+	if (unlikely(len > READ_ONCE(st->msgq_max)))
+		WRITE_ONCE(st->msgq_max, len);
 	if (likely(!test_bit(mISDN_STACK_STOPPED, &st->status))) {
 		test_and_set_bit(mISDN_STACK_WORK, &st->status);
 		wake_up_interruptible(&st->workq);
@@ -48,20 +58,45 @@ mISDN_queue_message(struct mISDNchannel *ch, struct sk_buff *skb)
 	return 0;
 }
 
+#define l2hash_head(tbl, key)	(&(tbl)[hash_min(key, HASH_BITS(tbl))])
+
+/*
+ * the first added channel wins, like on the list. a rehash adds the
+ * channel at the head of its new bucket, so the order of a bucket is not
+ * the order of adding, l2seq is.
+ * the lock is taken with irqs saved, set_channel_address() may be called
+ * with irqs disabled (teimgr lock).
+ */
+#define l2hash_older(a, b)	((int)((a)->l2seq - (b)->l2seq) < 0)
+
 static struct mISDNchannel *
 get_channel4id(struct mISDNstack *st, u_int id)
 {
-	struct mISDNchannel	*ch;
+	struct mISDNchannel	*ch, *found = NULL;
+	u_long			flags;
 
-	mutex_lock(&st->lmutex);
-	list_for_each_entry(ch, &st->layer2, list) {
-		if (id == ch->nr)
-			goto unlock;
+	spin_lock_irqsave(&st->l2hash_lock, flags);
+	hlist_for_each_entry(ch, l2hash_head(st->l2nr, id), nr_node) {
+		if (id == ch->nr && (!found || l2hash_older(ch, found)))
+			found = ch;
 	}
-	ch = NULL;
-unlock:
-	mutex_unlock(&st->lmutex);
-	return ch;
+	spin_unlock_irqrestore(&st->l2hash_lock, flags);
+	return found;
+}
+
+static struct mISDNchannel *
+get_channel4addr(struct mISDNstack *st, u_int addr)
+{
+	struct mISDNchannel	*ch, *found = NULL;
+	u_long			flags;
+
+	spin_lock_irqsave(&st->l2hash_lock, flags);
+	hlist_for_each_entry(ch, l2hash_head(st->l2addr, addr), addr_node) {
+		if (addr == ch->addr && (!found || l2hash_older(ch, found)))
+			found = ch;
+	}
+	spin_unlock_irqrestore(&st->l2hash_lock, flags);
+	return found;
 }
 
 static void
@@ -70,12 +105,13 @@ send_socklist(struct mISDN_sock_list *sl, struct sk_buff *skb)
 	struct sock		*sk;
 	struct sk_buff		*cskb = NULL;
 
-	read_lock(&sl->lock);
-	sk_for_each(sk, &sl->head) {
+	/* the sockets only read the data, so a clone is enough */
+	rcu_read_lock();
+	sk_for_each_rcu(sk, &sl->head) {
 		if (sk->sk_state != MISDN_BOUND)
 			continue;
 		if (!cskb)
-			cskb = skb_copy(skb, GFP_ATOMIC);
+			cskb = skb_clone(skb, GFP_ATOMIC);
 		if (!cskb) {
 			printk(KERN_WARNING "%s no skb\n", __func__);
 			break;
@@ -83,7 +119,7 @@ send_socklist(struct mISDN_sock_list *sl, struct sk_buff *skb)
 		if (!sock_queue_rcv_skb(sk, cskb))
 			cskb = NULL;
 	}
-	read_unlock(&sl->lock);
+	rcu_read_unlock();
 	if (cskb)
 		dev_kfree_skb(cskb);
 }
@@ -125,13 +161,12 @@ send_layer2(struct mISDNstack *st, struct sk_buff *skb)
 			}
 		}
 	} else {
-		list_for_each_entry(ch, &st->layer2, list) {
-			if ((hh->id & MISDN_ID_ADDR_MASK) == ch->addr) {
-				ret = ch->send(ch, skb);
-				if (!ret)
-					skb = NULL;
-				goto out;
-			}
+		ch = get_channel4addr(st, hh->id & MISDN_ID_ADDR_MASK);
+		if (ch) {
+			ret = ch->send(ch, skb);
+			if (!ret)
+				skb = NULL;
+			goto out;
 		}
 		ret = st->dev->teimgr->ctrl(st->dev->teimgr, CHECK_DATA, skb);
 		if (!ret)
@@ -201,15 +236,104 @@ do_clear_stack(struct mISDNstack *st)
 {
 }
 
+/* the counters are only written by the stack thread */
+#define stack_stats_inc(st, field)					\
+	do {								\
+		struct mISDNstack_stats *__s = get_cpu_ptr((st)->stats); \
+									\
+		u64_stats_update_begin(&__s->syncp);			\
+		__s->field++;						\
+		u64_stats_update_end(&__s->syncp);			\
+		put_cpu_ptr((st)->stats);				\
+	} while (0)
+
+/* count dispatch time in the log2 microsecond histogram */
+static inline void
+stack_count_latency(struct mISDNstack *st, u64 ns)
+{
+	int	slot = fls64(ns >> 10);
+
+	if (slot >= MISDN_STACK_LAT_SLOTS)
+		slot = MISDN_STACK_LAT_SLOTS - 1;
+	stack_stats_inc(st, latency[slot]);
+}
+
+/*
+ * sum up the per cpu statistics of a stack
+ */
+static void
+mISDN_stack_get_stats(struct mISDNstack *st, struct mISDNstack_stats *sum)
+{
+	struct mISDNstack_stats	*s, tmp;
+	unsigned int		start;
+	int			cpu, i;
+
+	memset(sum, 0, sizeof(*sum));
+	for_each_possible_cpu(cpu) {
+		s = per_cpu_ptr(st->stats, cpu);
+		do {
+			start = u64_stats_fetch_begin(&s->syncp);
+			tmp.msg_cnt = s->msg_cnt;
+			tmp.sleep_cnt = s->sleep_cnt;
+			tmp.stopped_cnt = s->stopped_cnt;
+			tmp.err_cnt = s->err_cnt;
+			memcpy(tmp.latency, s->latency, sizeof(tmp.latency));
+		} while (u64_stats_fetch_retry(&s->syncp, start));
+		sum->msg_cnt += tmp.msg_cnt;
+		sum->sleep_cnt += tmp.sleep_cnt;
+		sum->stopped_cnt += tmp.stopped_cnt;
+		sum->err_cnt += tmp.err_cnt;
+		for (i = 0; i < MISDN_STACK_LAT_SLOTS; i++)
+			sum->latency[i] += tmp.latency[i];
+	}
+}
+
+static int
+stack_stats_show(struct seq_file *m, void *v)
+{
+	struct mISDNstack	*st = m->private;
+	struct mISDNstack_stats	sum;
+	int			i;
+
+	mISDN_stack_get_stats(st, &sum);
+	seq_printf(m, "device %s\n", dev_name(&st->dev->dev));
+	seq_printf(m, "msgs %llu\n", sum.msg_cnt);
+	seq_printf(m, "wakeups %llu\n", sum.sleep_cnt);
+	seq_printf(m, "stopped %llu\n", sum.stopped_cnt);
+	seq_printf(m, "errors %llu\n", sum.err_cnt);
+	seq_printf(m, "queue_max %u\n", READ_ONCE(st->msgq_max));
+	seq_puts(m, "latency_us");
+	for (i = 0; i < MISDN_STACK_LAT_SLOTS; i++)
+		seq_printf(m, " %llu", sum.latency[i]);
+	seq_puts(m, "\n");
+	return 0;
+}
+
+static int
+stack_stats_open(struct inode *inode, struct file *file)
+{
+	return single_open(file, stack_stats_show, inode->i_private);
+}
+
+static const struct file_operations stack_stats_fops = {
+	.owner		= THIS_MODULE,
+	.open		= stack_stats_open,
+	.read		= seq_read,
+	.llseek		= seq_lseek,
+	.release	= single_release,
+};
+
 static int
 mISDNStackd(void *data)
 {
 	struct mISDNstack *st = data;
-#ifdef MISDN_MSG_STATS
-	u64 utime, stime;
-#endif
+	struct mISDNstack_stats sum;
+	u64 utime, stime, start;
+	struct sk_buff_head batch;
+	u_long flags;
 	int err = 0;
 
+	__skb_queue_head_init(&batch);
 	sigfillset(&current->blocked);
 	if (*debug & DEBUG_MSG_THREAD)
 		printk(KERN_DEBUG "mISDNStackd %s started\n",
@@ -229,34 +353,46 @@ mISDNStackd(void *data)
 		} else
 			test_and_set_bit(mISDN_STACK_RUNNING, &st->status);
 		while (test_bit(mISDN_STACK_WORK, &st->status)) {
-			skb = skb_dequeue(&st->msgq);
-			if (!skb) {
+			/* take all pending messages with one lock */
+			spin_lock_irqsave(&st->msgq.lock, flags);
+			skb_queue_splice_tail_init(&st->msgq, &batch);
+			/*
+			 * new messages are queued under this lock before
+			 * the WORK bit is set, so no race here
+			 */
+			if (skb_queue_empty(&batch))
 				test_and_clear_bit(mISDN_STACK_WORK,
 						   &st->status);
-				/* test if a race happens */
-				skb = skb_dequeue(&st->msgq);
-				if (!skb)
+			spin_unlock_irqrestore(&st->msgq.lock, flags);
+
+			while ((skb = __skb_dequeue(&batch))) {
+				stack_stats_inc(st, msg_cnt);
+				start = local_clock();
+				err = send_msg_to_layer(st, skb);
+				stack_count_latency(st, local_clock() - start);
+				if (unlikely(err)) {
+					stack_stats_inc(st, err_cnt);
+					if (*debug & DEBUG_SEND_ERR)
+						printk(KERN_DEBUG
+						       "%s: %s prim(%x) id(%x) "
+						       "send call(%d)\n",
+						       __func__,
+						       dev_name(&st->dev->dev),
+						       mISDN_HEAD_PRIM(skb),
+						       mISDN_HEAD_ID(skb), err);
+					dev_kfree_skb(skb);
 					continue;
-				test_and_set_bit(mISDN_STACK_WORK,
-						 &st->status);
-			}
-#ifdef MISDN_MSG_STATS
-			st->msg_cnt++;
-#endif
-			err = send_msg_to_layer(st, skb);
-			if (unlikely(err)) {
-				if (*debug & DEBUG_SEND_ERR)
-					printk(KERN_DEBUG
-					       "%s: %s prim(%x) id(%x) "
-					       "send call(%d)\n",
-					       __func__, dev_name(&st->dev->dev),
-					       mISDN_HEAD_PRIM(skb),
-					       mISDN_HEAD_ID(skb), err);
-				dev_kfree_skb(skb);
-				continue;
+				}
+				if (unlikely(test_bit(mISDN_STACK_STOPPED,
+						      &st->status)))
+					break;
 			}
 			if (unlikely(test_bit(mISDN_STACK_STOPPED,
 					      &st->status))) {
+				/* requeue the rest in order for restart */
+				spin_lock_irqsave(&st->msgq.lock, flags);
+				skb_queue_splice_init(&batch, &st->msgq);
+				spin_unlock_irqrestore(&st->msgq.lock, flags);
 				test_and_clear_bit(mISDN_STACK_WORK,
 						   &st->status);
 				test_and_clear_bit(mISDN_STACK_RUNNING,
@@ -284,9 +420,7 @@ mISDNStackd(void *data)
 			complete(st->notify);
 			st->notify = NULL;
 		}
-#ifdef MISDN_MSG_STATS
-		st->sleep_cnt++;
-#endif
+		stack_stats_inc(st, sleep_cnt);
 		test_and_clear_bit(mISDN_STACK_ACTIVE, &st->status);
 		wait_event_interruptible(st->workq, (st->status &
 						     mISDN_STACK_ACTION_MASK));
@@ -299,26 +433,26 @@ mISDNStackd(void *data)
 
 		if (test_bit(mISDN_STACK_STOPPED, &st->status)) {
 			test_and_clear_bit(mISDN_STACK_RUNNING, &st->status);
-#ifdef MISDN_MSG_STATS
-			st->stopped_cnt++;
-#endif
+			stack_stats_inc(st, stopped_cnt);
 		}
 	}
-#ifdef MISDN_MSG_STATS
-	printk(KERN_DEBUG "mISDNStackd daemon for %s proceed %d "
-	       "msg %d sleep %d stopped\n",
-	       dev_name(&st->dev->dev), st->msg_cnt, st->sleep_cnt,
-	       st->stopped_cnt);
-	task_cputime(st->thread, &utime, &stime);
-	printk(KERN_DEBUG
-	       "mISDNStackd daemon for %s utime(%llu) stime(%llu)\n",
-	       dev_name(&st->dev->dev), utime, stime);
-	printk(KERN_DEBUG
-	       "mISDNStackd daemon for %s nvcsw(%ld) nivcsw(%ld)\n",
-	       dev_name(&st->dev->dev), st->thread->nvcsw, st->thread->nivcsw);
-	printk(KERN_DEBUG "mISDNStackd daemon for %s killed now\n",
-	       dev_name(&st->dev->dev));
-#endif
+	if (*debug & DEBUG_MSG_THREAD) {
+		mISDN_stack_get_stats(st, &sum);
+		printk(KERN_DEBUG "mISDNStackd daemon for %s proceed %llu "
+		       "msg %llu sleep %llu stopped\n",
+		       dev_name(&st->dev->dev), sum.msg_cnt, sum.sleep_cnt,
+		       sum.stopped_cnt);
+		task_cputime(st->thread, &utime, &stime);
+		printk(KERN_DEBUG
+		       "mISDNStackd daemon for %s utime(%llu) stime(%llu)\n",
+		       dev_name(&st->dev->dev), utime, stime);
+		printk(KERN_DEBUG
+		       "mISDNStackd daemon for %s nvcsw(%ld) nivcsw(%ld)\n",
+		       dev_name(&st->dev->dev), st->thread->nvcsw,
+		       st->thread->nivcsw);
+		printk(KERN_DEBUG "mISDNStackd daemon for %s killed now\n",
+		       dev_name(&st->dev->dev));
+	}
 	test_and_set_bit(mISDN_STACK_KILLED, &st->status);
 	test_and_clear_bit(mISDN_STACK_RUNNING, &st->status);
 	test_and_clear_bit(mISDN_STACK_ACTIVE, &st->status);
@@ -345,13 +479,49 @@ l1_receive(struct mISDNchannel *ch, struct sk_buff *skb)
 void
 set_channel_address(struct mISDNchannel *ch, u_int sapi, u_int tei)
 {
-	ch->addr = sapi | (tei << 8);
+	struct mISDNstack	*st = ch->st;
+	u_long			flags;
+
+	if (!st) {
+		ch->addr = sapi | (tei << 8);
+		return;
+	}
+	/* if the channel is in the stack, rehash it, l2seq is kept */
+	spin_lock_irqsave(&st->l2hash_lock, flags);
+	if (hlist_unhashed(&ch->addr_node)) {
+		ch->addr = sapi | (tei << 8);
+	} else {
+		hlist_del_init(&ch->addr_node);
+		ch->addr = sapi | (tei << 8);
+		hlist_add_head(&ch->addr_node,
+			       l2hash_head(st->l2addr, ch->addr));
+	}
+	spin_unlock_irqrestore(&st->l2hash_lock, flags);
 }
 
 void
 __add_layer2(struct mISDNchannel *ch, struct mISDNstack *st)
 {
+	u_long	flags;
+
 	list_add_tail(&ch->list, &st->layer2);
+	spin_lock_irqsave(&st->l2hash_lock, flags);
+	ch->l2seq = ++st->l2seq;
+	hlist_add_head(&ch->nr_node, l2hash_head(st->l2nr, ch->nr));
+	hlist_add_head(&ch->addr_node, l2hash_head(st->l2addr, ch->addr));
+	spin_unlock_irqrestore(&st->l2hash_lock, flags);
+}
+
+void
+__del_layer2(struct mISDNchannel *ch, struct mISDNstack *st)
+{
+	u_long	flags;
+
+	list_del(&ch->list);
+	spin_lock_irqsave(&st->l2hash_lock, flags);
+	hlist_del_init(&ch->nr_node);
+	hlist_del_init(&ch->addr_node);
+	spin_unlock_irqrestore(&st->l2hash_lock, flags);
 }
 
 void
@@ -374,7 +544,8 @@ int
 create_stack(struct mISDNdevice *dev)
 {
 	struct mISDNstack	*newst;
-	int			err;
+	char			name[16];
+	int			err, cpu;
 	DECLARE_COMPLETION_ONSTACK(done);
 
 	newst = kzalloc(sizeof(struct mISDNstack), GFP_KERNEL);
@@ -382,10 +553,29 @@ create_stack(struct mISDNdevice *dev)
 		printk(KERN_ERR "kmalloc mISDN_stack failed\n");
 		return -ENOMEM;
 	}
+	if (!alloc_cpumask_var(&newst->cpus, GFP_KERNEL)) {
+		printk(KERN_ERR "kmalloc mISDN_stack cpus failed\n");
+		kfree(newst);
+		return -ENOMEM;
+	}
+	newst->stats = alloc_percpu(struct mISDNstack_stats);
+	if (!newst->stats) {
+		printk(KERN_ERR "kmalloc mISDN_stack stats failed\n");
+		free_cpumask_var(newst->cpus);
+		kfree(newst);
+		return -ENOMEM;
+	}
+	for_each_possible_cpu(cpu)
+		u64_stats_init(&per_cpu_ptr(newst->stats, cpu)->syncp);
+	cpumask_copy(newst->cpus, cpu_possible_mask);
+	newst->irq = -1;
 	newst->dev = dev;
 	INIT_LIST_HEAD(&newst->layer2);
+	hash_init(newst->l2nr);
+	hash_init(newst->l2addr);
+	spin_lock_init(&newst->l2hash_lock);
 	INIT_HLIST_HEAD(&newst->l1sock.head);
-	rwlock_init(&newst->l1sock.lock);
+	spin_lock_init(&newst->l1sock.lock);
 	init_waitqueue_head(&newst->workq);
 	skb_queue_head_init(&newst->msgq);
 	mutex_init(&newst->lmutex);
@@ -393,6 +583,8 @@ create_stack(struct mISDNdevice *dev)
 	err = create_teimanager(dev);
 	if (err) {
 		printk(KERN_ERR "kmalloc teimanager failed\n");
+		free_percpu(newst->stats);
+		free_cpumask_var(newst->cpus);
 		kfree(newst);
 		return err;
 	}
@@ -418,9 +610,16 @@ create_stack(struct mISDNdevice *dev)
 		       "mISDN:cannot create kernel thread for %s (%d)\n",
 		       dev_name(&newst->dev->dev), err);
 		delete_teimanager(dev->teimgr);
+		free_percpu(newst->stats);
+		free_cpumask_var(newst->cpus);
 		kfree(newst);
-	} else
+	} else {
 		wait_for_completion(&done);
+		sprintf(name, "stack%d", dev->id);
+		newst->debugfs = debugfs_create_file(name, S_IRUSR,
+						     mISDN_debugfs, newst,
+						     &stack_stats_fops);
+	}
 	return err;
 }
 
@@ -452,9 +651,9 @@ connect_layer1(struct mISDNdevice *dev, struct mISDNchannel *ch,
 		       dev->id);
 		if (err)
 			return err;
-		write_lock_bh(&dev->D.st->l1sock.lock);
-		sk_add_node(&msk->sk, &dev->D.st->l1sock.head);
-		write_unlock_bh(&dev->D.st->l1sock.lock);
+		spin_lock_bh(&dev->D.st->l1sock.lock);
+		sk_add_node_rcu(&msk->sk, &dev->D.st->l1sock.head);
+		spin_unlock_bh(&dev->D.st->l1sock.lock);
 		break;
 	default:
 		return -ENOPROTOOPT;
@@ -593,16 +792,16 @@ delete_channel(struct mISDNchannel *ch)
 	case ISDN_P_TE_S0:
 	case ISDN_P_NT_E1:
 	case ISDN_P_TE_E1:
-		write_lock_bh(&ch->st->l1sock.lock);
-		sk_del_node_init(&msk->sk);
-		write_unlock_bh(&ch->st->l1sock.lock);
+		spin_lock_bh(&ch->st->l1sock.lock);
+		sk_del_node_init_rcu(&msk->sk);
+		spin_unlock_bh(&ch->st->l1sock.lock);
 		ch->st->dev->D.ctrl(&ch->st->dev->D, CLOSE_CHANNEL, NULL);
 		break;
 	case ISDN_P_LAPD_TE:
 		pch = get_channel4id(ch->st, ch->nr);
 		if (pch) {
 			mutex_lock(&ch->st->lmutex);
-			list_del(&pch->list);
+			__del_layer2(pch, ch->st);
 			mutex_unlock(&ch->st->lmutex);
 			pch->ctrl(pch, CLOSE_CHANNEL, NULL);
 			pch = ch->st->dev->teimgr;
@@ -634,6 +833,7 @@ delete_stack(struct mISDNdevice *dev)
 	if (*debug & DEBUG_CORE_FUNC)
 		printk(KERN_DEBUG "%s: st(%s)\n", __func__,
 		       dev_name(&st->dev->dev));
+	debugfs_remove(st->debugfs);
 	if (dev->teimgr)
 		delete_teimanager(dev->teimgr);
 	if (st->thread) {
@@ -654,9 +854,71 @@ delete_stack(struct mISDNdevice *dev)
 	if (!hlist_empty(&st->l1sock.head))
 		printk(KERN_WARNING "%s: layer1 list not empty\n",
 		       __func__);
+	free_percpu(st->stats);
+	free_cpumask_var(st->cpus);
 	kfree(st);
 }
 
+/*
+ * pin the stack thread to the given cpus
+ */
+int
+mISDN_stack_set_cpus(struct mISDNstack *st, const struct cpumask *cpus)
+{
+	int	err;
+
+	if (!st->thread)
+		return -ESRCH;
+	err = set_cpus_allowed_ptr(st->thread, cpus);
+	if (err)
+		return err;
+	cpumask_copy(st->cpus, cpus);
+	st->irq = -1;
+	return 0;
+}
+
+/*
+ * run the stack thread with SCHED_FIFO priority, or normal if prio is 0
+ */
+int
+mISDN_stack_set_prio(struct mISDNstack *st, int prio)
+{
+	struct sched_param	param = { .sched_priority = prio };
+	int			err;
+
+	if (prio < 0 || prio >= MAX_USER_RT_PRIO)
+		return -EINVAL;
+	if (!st->thread)
+		return -ESRCH;
+	err = sched_setscheduler_nocheck(st->thread,
+					 prio ? SCHED_FIFO : SCHED_NORMAL,
+					 &param);
+	if (err)
+		return err;
+	st->prio = prio;
+	return 0;
+}
+
+/*
+ * run the stack thread on the cpus the given irq (of the card) is
+ * delivered to, the affinity is copied once
+ */
+int
+mISDN_stack_set_irq(struct mISDNstack *st, int irq)
+{
+	struct irq_data	*data;
+	int		err;
+
+	data = irq_get_irq_data(irq);
+	if (!data)
+		return -EINVAL;
+	err = mISDN_stack_set_cpus(st, irq_data_get_affinity_mask(data));
+	if (err)
+		return err;
+	st->irq = irq;
+	return 0;
+}
+
 void
 mISDN_initstack(u_int *dp)
 {
@@ -36,6 +36,8 @@
 
 static	u_int	*debug;
 
+static struct mISDN_cache teimgr_cache;
+
 static struct Fsm deactfsm = {NULL, 0, 0, NULL, NULL};
 static struct Fsm teifsmu = {NULL, 0, 0, NULL, NULL};
 static struct Fsm teifsmn = {NULL, 0, 0, NULL, NULL};
@@ -661,7 +663,7 @@ tei_l2remove(struct layer2 *l2)
 {
 	put_tei_msg(l2->tm->mgr, ID_REMOVE, 0, l2->tei);
 	tei_l2(l2, MDL_REMOVE_REQ, 0);
-	list_del(&l2->ch.list);
+	__del_layer2(&l2->ch, l2->ch.st);
 	l2->ch.ctrl(&l2->ch, CLOSE_CHANNEL, NULL);
 }
 
@@ -812,9 +814,9 @@ create_new_tei(struct manager *mgr, int tei, int sapi)
 		printk(KERN_WARNING "%s:no memory for layer2\n", __func__);
 		return NULL;
 	}
-	l2->tm = kzalloc(sizeof(struct teimgr), GFP_KERNEL);
+	l2->tm = mISDN_cache_alloc(&teimgr_cache, GFP_KERNEL);
 	if (!l2->tm) {
-		kfree(l2);
+		free_l2(l2);
 		printk(KERN_WARNING "%s:no memory for teimgr\n", __func__);
 		return NULL;
 	}
@@ -985,7 +987,7 @@ TEIrelease(struct layer2 *l2)
 	list_del(&l2->list);
 	write_unlock_irqrestore(&tm->mgr->lock, flags);
 	l2->tm = NULL;
-	kfree(tm);
+	mISDN_cache_free(&teimgr_cache, tm);
 }
 
 static int
@@ -1055,9 +1057,9 @@ create_teimgr(struct manager *mgr, struct channel_req *crq)
 		       crq->adr.tei, crq->adr.sapi);
 	if (!l2)
 		return -ENOMEM;
-	l2->tm = kzalloc(sizeof(struct teimgr), GFP_KERNEL);
+	l2->tm = mISDN_cache_alloc(&teimgr_cache, GFP_KERNEL);
 	if (!l2->tm) {
-		kfree(l2);
+		free_l2(l2);
 		printk(KERN_ERR "kmalloc teimgr failed\n");
 		return -ENOMEM;
 	}
@@ -1157,7 +1159,7 @@ free_teimanager(struct manager *mgr)
 			list_for_each_entry_safe(l2, nl2, &mgr->layer2, list) {
 				put_tei_msg(mgr, ID_REMOVE, 0, l2->tei);
 				mutex_lock(&mgr->ch.st->lmutex);
-				list_del(&l2->ch.list);
+				__del_layer2(&l2->ch, mgr->ch.st);
 				mutex_unlock(&mgr->ch.st->lmutex);
 				l2->ch.ctrl(&l2->ch, CLOSE_CHANNEL, NULL);
 			}
@@ -1254,12 +1256,12 @@ delete_teimanager(struct mISDNchannel *ch)
 	/* not locked lock is taken in release tei */
 	list_for_each_entry_safe(l2, nl2, &mgr->layer2, list) {
 		mutex_lock(&mgr->ch.st->lmutex);
-		list_del(&l2->ch.list);
+		__del_layer2(&l2->ch, mgr->ch.st);
 		mutex_unlock(&mgr->ch.st->lmutex);
 		l2->ch.ctrl(&l2->ch, CLOSE_CHANNEL, NULL);
 	}
-	list_del(&mgr->ch.list);
-	list_del(&mgr->bcast.list);
+	__del_layer2(&mgr->ch, mgr->ch.st);
+	__del_layer2(&mgr->bcast, mgr->ch.st);
 	skb_queue_purge(&mgr->sendq);
 	kfree(mgr);
 }
@@ -1385,10 +1387,20 @@ create_teimanager(struct mISDNdevice *dev)
 	return 0;
 }
 
+static void
+teimgr_ctor(void *obj)
+{
+	memset(obj, 0, sizeof(struct teimgr));
+}
+
 int TEIInit(u_int *deb)
 {
 	int res;
 	debug = deb;
+	res = mISDN_cache_create(&teimgr_cache, "mISDN_teimgr",
+				 sizeof(struct teimgr), teimgr_ctor);
+	if (res)
+		return res;
 	teifsmu.state_count = TEI_STATE_COUNT;
 	teifsmu.event_count = TEI_EVENT_COUNT;
 	teifsmu.strEvent = strTeiEvent;
@@ -1417,6 +1429,7 @@ error_deact:
 error_smn:
 	mISDN_FsmFree(&teifsmu);
 error:
+	mISDN_cache_destroy(&teimgr_cache);
 	return res;
 }
 
@@ -1425,4 +1438,5 @@ void TEIFree(void)
 	mISDN_FsmFree(&teifsmu);
 	mISDN_FsmFree(&teifsmn);
 	mISDN_FsmFree(&deactfsm);
+	mISDN_cache_destroy(&teimgr_cache);
 }
@@ -20,7 +20,7 @@
 #include <linux/poll.h>
 #include <linux/vmalloc.h>
 #include <linux/slab.h>
-#include <linux/timer.h>
+#include <linux/hrtimer.h>
 #include <linux/miscdevice.h>
 #include <linux/module.h>
 #include <linux/mISDNif.h>
@@ -45,10 +45,12 @@ struct mISDNtimerdev {
 struct mISDNtimer {
 	struct list_head	list;
 	struct  mISDNtimerdev	*dev;
-	struct timer_list	tl;
+	struct hrtimer		tl;
 	int			id;
 };
 
+static struct mISDN_cache	timer_cache;
+
 static int
 mISDN_open(struct inode *ino, struct file *filep)
 {
@@ -83,28 +85,33 @@ mISDN_close(struct inode *ino, struct file *filep)
 	while (!list_empty(list)) {
 		timer = list_first_entry(list, struct mISDNtimer, list);
 		spin_unlock_irq(&dev->lock);
-		del_timer_sync(&timer->tl);
+		hrtimer_cancel(&timer->tl);
 		spin_lock_irq(&dev->lock);
 		/* it might have been moved to ->expired */
 		list_del(&timer->list);
-		kfree(timer);
+		mISDN_cache_free(&timer_cache, timer);
 	}
 	spin_unlock_irq(&dev->lock);
 
 	list_for_each_entry_safe(timer, next, &dev->expired, list) {
-		kfree(timer);
+		mISDN_cache_free(&timer_cache, timer);
 	}
 	kfree(dev);
 	return 0;
 }
 
+/*
+ * returns the ids of all expired timers, as many as fit into the buffer
+ */
 static ssize_t
 mISDN_read(struct file *filep, char __user *buf, size_t count, loff_t *off)
 {
 	struct mISDNtimerdev	*dev = filep->private_data;
 	struct list_head *list = &dev->expired;
-	struct mISDNtimer	*timer;
-	int	ret = 0;
+	struct mISDNtimer	*timer, *next;
+	LIST_HEAD(done);
+	int __user		*ids = (int __user *)buf;
+	int	ret = 0, cnt = 0;
 
 	if (*debug & DEBUG_TIMER)
 		printk(KERN_DEBUG "%s(%p, %p, %d, %p)\n", __func__,
@@ -126,19 +133,17 @@ mISDN_read(struct file *filep, char __user *buf, size_t count, loff_t *off)
 	}
 	if (dev->work)
 		dev->work = 0;
-	if (!list_empty(list)) {
-		timer = list_first_entry(list, struct mISDNtimer, list);
-		list_del(&timer->list);
-		spin_unlock_irq(&dev->lock);
-		if (put_user(timer->id, (int __user *)buf))
+	while (!list_empty(list) && count >= (cnt + 1) * sizeof(int)) {
+		list_move_tail(list->next, &done);
+		cnt++;
+	}
+	spin_unlock_irq(&dev->lock);
+	list_for_each_entry_safe(timer, next, &done, list) {
+		if (!ret && put_user(timer->id, ids++))
 			ret = -EFAULT;
-		else
-			ret = sizeof(int);
-		kfree(timer);
-	} else {
-		spin_unlock_irq(&dev->lock);
+		mISDN_cache_free(&timer_cache, timer);
 	}
-	return ret;
+	return ret ? ret : cnt * sizeof(int);
 }
 
 static unsigned int
@@ -161,10 +166,10 @@ mISDN_poll(struct file *filep, poll_table *wait)
 	return mask;
 }
 
-static void
-dev_expire_timer(unsigned long data)
+static enum hrtimer_restart
+dev_expire_timer(struct hrtimer *tl)
 {
-	struct mISDNtimer *timer = (void *)data;
+	struct mISDNtimer *timer = container_of(tl, struct mISDNtimer, tl);
 	u_long			flags;
 
 	spin_lock_irqsave(&timer->dev->lock, flags);
@@ -172,6 +177,7 @@ dev_expire_timer(unsigned long data)
 		list_move_tail(&timer->list, &timer->dev->expired);
 	spin_unlock_irqrestore(&timer->dev->lock, flags);
 	wake_up_interruptible(&timer->dev->wait);
+	return HRTIMER_NORESTART;
 }
 
 static int
@@ -185,18 +191,17 @@ misdn_add_timer(struct mISDNtimerdev *dev, int timeout)
 		wake_up_interruptible(&dev->wait);
 		id = 0;
 	} else {
-		timer = kzalloc(sizeof(struct mISDNtimer), GFP_KERNEL);
+		timer = mISDN_cache_alloc(&timer_cache, GFP_KERNEL);
 		if (!timer)
 			return -ENOMEM;
 		timer->dev = dev;
-		setup_timer(&timer->tl, dev_expire_timer, (long)timer);
 		spin_lock_irq(&dev->lock);
 		id = timer->id = dev->next_id++;
 		if (dev->next_id < 0)
 			dev->next_id = 1;
 		list_add_tail(&timer->list, &dev->pending);
-		timer->tl.expires = jiffies + ((HZ * (u_long)timeout) / 1000);
-		add_timer(&timer->tl);
+		hrtimer_start(&timer->tl, ms_to_ktime(timeout),
+			      HRTIMER_MODE_REL);
 		spin_unlock_irq(&dev->lock);
 	}
 	return id;
@@ -213,8 +218,8 @@ misdn_del_timer(struct mISDNtimerdev *dev, int id)
 			list_del_init(&timer->list);
 			timer->id = -1;
 			spin_unlock_irq(&dev->lock);
-			del_timer_sync(&timer->tl);
-			kfree(timer);
+			hrtimer_cancel(&timer->tl);
+			mISDN_cache_free(&timer_cache, timer);
 			return id;
 		}
 	}
@@ -284,19 +289,36 @@ static struct miscdevice mISDNtimer = {
 	.fops	= &mISDN_fops,
 };
 
+static void
+timer_ctor(void *obj)
+{
+	struct mISDNtimer *timer = obj;
+
+	memset(timer, 0, sizeof(*timer));
+	hrtimer_init(&timer->tl, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	timer->tl.function = dev_expire_timer;
+}
+
 int
 mISDN_inittimer(u_int *deb)
 {
 	int	err;
 
 	debug = deb;
-	err = misc_register(&mISDNtimer);
+	err = mISDN_cache_create(&timer_cache, "mISDN_timer",
+				 sizeof(struct mISDNtimer), timer_ctor);
 	if (err)
+		return err;
+	err = misc_register(&mISDNtimer);
+	if (err) {
 		printk(KERN_WARNING "mISDN: Could not register timer device\n");
+		mISDN_cache_destroy(&timer_cache);
+	}
 	return err;
 }
 
 void mISDN_timer_cleanup(void)
 {
 	misc_deregister(&mISDNtimer);
+	mISDN_cache_destroy(&timer_cache);
 }
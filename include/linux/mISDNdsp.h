@@ -22,6 +22,12 @@ struct mISDN_dsp_element {
 extern int  mISDN_dsp_element_register(struct mISDN_dsp_element *elem);
 extern void mISDN_dsp_element_unregister(struct mISDN_dsp_element *elem);
 
+#ifdef CONFIG_X86_64
+/* fpu section for simd code of elements, see dsp_mix.c */
+extern int  dsp_fpu_begin(void);
+extern void dsp_fpu_end(int fpu);
+#endif
+
 struct dsp_features {
 	int	hfc_id; /* unique id to identify the chip (or -1) */
 	int	hfc_dtmf; /* set if HFCmulti card supports dtmf */
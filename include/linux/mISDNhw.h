@@ -76,6 +76,7 @@
 /* stop sending received data upstream */
 #define FLG_RX_OFF		28
 /* workq events */
+#define FLG_RXPOOL		29
 #define FLG_RECVQUEUE		30
 #define	FLG_PHCHANGE		31
 
@@ -145,6 +146,11 @@ struct layer1;
 extern int	l1_event(struct layer1 *, u_int);
 
 #define MISDN_BCH_FILL_SIZE	4
+/* preallocated receive buffers per B-channel */
+#define MISDN_BCH_RXPOOL	8
+/* default and maximum receive queue depth, see MISDN_CTRL_RX_QUEUE */
+#define MISDN_BCH_RQUEUE	64
+#define MISDN_BCH_RQUEUE_MAX	1024
 
 struct bchannel {
 	struct mISDNchannel	ch;
@@ -164,11 +170,14 @@ struct bchannel {
 	unsigned short		minlen; /* for transparent data */
 	unsigned short		init_minlen; /* initial value */
 	unsigned short		next_minlen; /* pending value */
+	struct sk_buff_head	rxpool;
+	int			rxpool_len; /* buffer size of the pool */
 	/* send data */
 	struct sk_buff		*next_skb;
 	struct sk_buff		*tx_skb;
 	struct sk_buff_head	rqueue;
 	int			rcount;
+	int			rqueue_max;
 	int			tx_idx;
 	int			debug;
 	/* statistics */
@@ -176,6 +185,7 @@ struct bchannel {
 	int			err_tx;
 	int			err_rx;
 	int			dropcnt;
+	u_int			rx_overflow; /* frames dropped from rqueue */
 };
 
 extern int	mISDN_initdchannel(struct dchannel *, int, void *);
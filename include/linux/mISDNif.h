@@ -309,6 +309,29 @@ struct mISDN_devrename {
 	char			name[MISDN_MAX_IDLEN]; /* new name */
 };
 
+/*
+ * one frame of IMRECVBATCH/IMSENDBATCH, buf holds the mISDNhead and data
+ * like a recvmsg/sendmsg on the data socket fd.
+ * pointers are passed as __u64, so 32 bit applications work with a 64 bit
+ * kernel, the layout is the same on both
+ */
+struct mISDN_batch_msg {
+	__s32			fd;	/* bound data socket */
+	__s32			result;	/* length or negative error */
+	__u32			len;	/* size of buf */
+	struct sockaddr_mISDN	addr;	/* channel, used on send if set */
+	__u8			pad[6];
+	__u64			buf;	/* user pointer to the data */
+};
+
+#define MISDN_BATCH_MAX		1024	/* max. frames of one batch */
+
+struct mISDN_batch {
+	__u32			nr;
+	__u32			pad;
+	__u64			msgs;	/* user pointer to nr mISDN_batch_msg */
+};
+
 /* MPH_INFORMATION_REQ payload */
 struct ph_info_ch {
 	__u32 protocol;
@@ -338,6 +361,8 @@ struct ph_info {
 #define IMCLEAR_L2	_IOR('I', 70, int)
 #define IMSETDEVNAME	_IOR('I', 71, struct mISDN_devrename)
 #define IMHOLD_L1	_IOR('I', 72, int)
+#define IMRECVBATCH	_IOWR('I', 73, struct mISDN_batch)
+#define IMSENDBATCH	_IOWR('I', 74, struct mISDN_batch)
 
 static inline int
 test_channelmap(u_int nr, u_char *map)
@@ -374,6 +399,7 @@ clear_channelmap(u_int nr, u_char *map)
 #define MISDN_CTRL_FILL_EMPTY		0x0200
 #define MISDN_CTRL_GETPEER		0x0400
 #define MISDN_CTRL_L1_TIMER3		0x0800
+#define MISDN_CTRL_RX_QUEUE		0x1000
 #define MISDN_CTRL_HW_FEATURES_OP	0x2000
 #define MISDN_CTRL_HW_FEATURES		0x2001
 #define MISDN_CTRL_HFC_OP		0x4000
@@ -396,6 +422,39 @@ clear_channelmap(u_int nr, u_char *map)
 
 /* socket options */
 #define MISDN_TIME_STAMP		0x0001
+#define MISDN_RX_RING			0x0002
+#define MISDN_TX_RING			0x0003
+
+/*
+ * mmap ring of a data socket, set with MISDN_RX_RING/MISDN_TX_RING
+ * a frame_nr of 0 removes the ring, the rx ring is mapped at offset 0,
+ * the tx ring follows page aligned
+ */
+struct mISDN_ring_req {
+	unsigned int	frame_size;	/* incl. header, MISDN_RING_ALIGNMENT */
+	unsigned int	frame_nr;
+};
+
+#define MISDN_RING_ALIGNMENT	16
+
+/* frame status */
+#define MISDN_FRAME_KERNEL	0x0	/* owned by the kernel */
+#define MISDN_FRAME_USER	0x1	/* rx: filled, tx: send request */
+#define MISDN_FRAME_LOSING	0x2	/* rx: frames were dropped before */
+
+struct mISDN_frame_hdr {
+	__u32		status;
+	__u32		len;		/* length of the data */
+	__u32		prim;
+	__u32		id;
+	__u64		tstamp;		/* rx: receive time in ns */
+	__s32		error;		/* tx: error, if the frame was not sent */
+	__u32		pad;
+};
+
+#define MISDN_FRAME_HDRLEN	((sizeof(struct mISDN_frame_hdr) + \
+				  MISDN_RING_ALIGNMENT - 1) & \
+				 ~(MISDN_RING_ALIGNMENT - 1))
 
 struct mISDN_ctrl_req {
 	int		op;
@@ -414,6 +473,10 @@ struct mISDN_ctrl_req {
 #include <linux/net.h>
 #include <net/sock.h>
 #include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/hashtable.h>
+#include <linux/workqueue.h>
+#include <linux/u64_stats_sync.h>
 
 #define DEBUG_CORE		0x000000ff
 #define DEBUG_CORE_FUNC		0x00000002
@@ -475,18 +538,29 @@ struct mISDNchannel {
 	send_func_t		*send;
 	send_func_t		*recv;
 	ctrl_func_t		*ctrl;
+	/* layer2 lookup in the stack */
+	struct hlist_node	nr_node;
+	struct hlist_node	addr_node;
+	u_int			l2seq; /* order of adding to the stack */
 };
 
+/* readers walk the list under rcu, the lock serializes the writers */
 struct mISDN_sock_list {
 	struct hlist_head	head;
-	rwlock_t		lock;
+	spinlock_t		lock;
 };
 
+struct mISDN_ring;
+
 struct mISDN_sock {
 	struct sock		sk;
 	struct mISDNchannel	ch;
 	u_int			cmask;
 	struct mISDNdevice	*dev;
+	struct mISDN_ring	*rx_ring;
+	struct mISDN_ring	*tx_ring;
+	struct work_struct	tx_work; /* sends the tx ring on PH_DATA_CNF */
+	atomic_t		mapped;
 };
 
 
@@ -503,6 +577,20 @@ struct mISDNdevice {
 	struct device		dev;
 };
 
+/* dispatch latency histogram slots: <1us, 1us, 2-3us, ... >=16ms */
+#define MISDN_STACK_LAT_SLOTS	16
+
+struct mISDNstack_stats {
+	u64			msg_cnt;
+	u64			sleep_cnt;
+	u64			stopped_cnt;
+	u64			err_cnt;
+	u64			latency[MISDN_STACK_LAT_SLOTS];
+	struct u64_stats_sync	syncp; /* only the stack thread writes */
+};
+
+#define MISDN_L2_HASH_BITS	6
+
 struct mISDNstack {
 	u_long			status;
 	struct mISDNdevice	*dev;
@@ -511,15 +599,21 @@ struct mISDNstack {
 	wait_queue_head_t	workq;
 	struct sk_buff_head	msgq;
 	struct list_head	layer2;
+	/* layer2 channels hashed by nr and by address */
+	DECLARE_HASHTABLE(l2nr, MISDN_L2_HASH_BITS);
+	DECLARE_HASHTABLE(l2addr, MISDN_L2_HASH_BITS);
+	spinlock_t		l2hash_lock; /* protect the hash tables */
+	u_int			l2seq; /* sequence of the last added channel */
 	struct mISDNchannel	*layer1;
 	struct mISDNchannel	own;
 	struct mutex		lmutex; /* protect lists */
 	struct mISDN_sock_list	l1sock;
-#ifdef MISDN_MSG_STATS
-	u_int			msg_cnt;
-	u_int			sleep_cnt;
-	u_int			stopped_cnt;
-#endif
+	cpumask_var_t		cpus; /* cpus the thread may run on */
+	int			prio; /* SCHED_FIFO priority, 0 = normal */
+	int			irq; /* irq the cpus are taken from or -1 */
+	struct mISDNstack_stats	__percpu *stats;
+	u_int			msgq_max; /* high watermark of msgq */
+	struct dentry		*debugfs; /* statistics file */
 };
 
 typedef	int	(clockctl_func_t)(void *, int);